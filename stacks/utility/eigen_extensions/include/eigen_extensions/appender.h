@@ -0,0 +1,187 @@
+#ifndef EIGEN_EXTENSIONS_APPENDER_H
+#define EIGEN_EXTENSIONS_APPENDER_H
+
+#include <eigen_extensions/eigen_extensions.h>
+#include <boost/noncopyable.hpp>
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+namespace eigen_extensions
+{
+
+  //! Grows a column-major .eig file one or more columns at a time.
+  //! Columns are buffered and written in large chunks; the cols field
+  //! of the header is only updated after the data it covers has been
+  //! written, so concurrent readers always see a complete prefix.
+  //! Opening a file that cannot be appended to aborts.  Failed writes
+  //! are reported by append(), flush() and close(), which return false
+  //! and keep the unwritten columns buffered.
+  template<class S>
+  class EigAppender : public boost::noncopyable
+  {
+  public:
+    //! Creates filename if it does not exist and appends to it if it does.
+    //! Columns are written whenever more than buffer_size bytes are buffered.
+    EigAppender(const std::string& filename, int64_t rows, size_t buffer_size = 4 * 1024 * 1024);
+    //! Calls close().
+    ~EigAppender();
+    //! Appends the columns of mat, which must have rows() rows.
+    //! Returns false if this triggered a flush that failed.
+    template<class Derived>
+    bool append(const Eigen::MatrixBase<Derived>& mat);
+    //! Writes buffered columns and updates the header.  Returns false,
+    //! after printing why, if either write failed.
+    bool flush();
+    //! Flushes and closes the file.  Returns false if anything failed.
+    bool close();
+    int64_t rows() const { return header_.rows; }
+    //! Number of columns, including those not yet flushed.
+    int64_t cols() const { return header_.cols + buffer_.size() / header_.rows; }
+
+  protected:
+    std::string filename_;
+    int fd_;
+    size_t buffer_size_;
+    //! Describes what is on disk.
+    EigHeader header_;
+    std::vector<S> buffer_;
+
+    bool pwriteAll(const char* buf, uint64_t num, uint64_t offset);
+  };
+
+
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+
+  template<class S>
+  EigAppender<S>::EigAppender(const std::string& filename, int64_t rows, size_t buffer_size) :
+    filename_(filename),
+    buffer_size_(buffer_size)
+  {
+    assert(rows > 0);
+    assert(boost::filesystem::extension(filename).compare(".eig") == 0);
+    fd_ = open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if(fd_ < 0) {
+      std::cerr << "Could not open " << filename << ": " << strerror(errno) << std::endl;
+      abort();
+    }
+
+    char buf[EIG_HEADER_SIZE];
+    ssize_t num = pread(fd_, buf, sizeof(buf), 0);
+    if(num < 0) {
+      std::cerr << "Could not read " << filename << ": " << strerror(errno) << std::endl;
+      abort();
+    }
+    if(num == 0) {
+      header_.bytes = sizeof(S);
+      header_.scalar_type = EigScalarTraits<S>::type;
+      header_.rows = rows;
+      header_.cols = 0;
+      if(!pwriteAll((const char*)&header_, sizeof(header_), 0))
+        abort();
+    }
+    else {
+      // A short read fails parseHeader().
+      bool valid = parseHeader(buf, num, &header_);
+      if(!valid || header_.version == 1 || header_.rowMajor() || !isDirectlyReadable<S>(header_) || header_.rows != rows) {
+        std::cerr << "EigAppender can only append to a version " << EIG_VERSION << " column-major "
+                  << scalarTypeName(EigScalarTraits<S>::type) << " .eig file with " << rows << " rows: "
+                  << filename << std::endl;
+        abort();
+      }
+    }
+
+    // -- Anything past the last complete column is left over from an
+    //    interrupted append and will be overwritten.
+    if(ftruncate(fd_, header_.dataOffset() + header_.payloadSize()) != 0) {
+      std::cerr << "Could not truncate " << filename << ": " << strerror(errno) << std::endl;
+      abort();
+    }
+    buffer_.reserve(buffer_size_ / sizeof(S) + rows);
+  }
+
+  template<class S>
+  EigAppender<S>::~EigAppender()
+  {
+    close();
+  }
+
+  template<class S>
+  template<class Derived>
+  bool EigAppender<S>::append(const Eigen::MatrixBase<Derived>& mat)
+  {
+    if(fd_ < 0) {
+      std::cerr << "Cannot append to " << filename_ << " after close()." << std::endl;
+      abort();
+    }
+    if(mat.rows() != header_.rows) {
+      std::cerr << "Cannot append a matrix with " << mat.rows() << " rows to " << filename_
+                << ", which has " << header_.rows << "." << std::endl;
+      abort();
+    }
+    size_t size = buffer_.size();
+    buffer_.resize(size + mat.size());
+    Eigen::Map< Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic> > dest(&buffer_[size], mat.rows(), mat.cols());
+    dest = mat.template cast<S>();
+    if(buffer_.size() * sizeof(S) >= buffer_size_)
+      return flush();
+    return true;
+  }
+
+  template<class S>
+  bool EigAppender<S>::flush()
+  {
+    if(buffer_.empty())
+      return true;
+
+    // -- Data first, then the header that makes it visible.  If either
+    //    write fails the header on disk still describes a complete
+    //    prefix, and the columns stay buffered for the next flush.
+    if(!pwriteAll((const char*)&buffer_[0], buffer_.size() * sizeof(S), header_.dataOffset() + header_.payloadSize()))
+      return false;
+    int64_t cols = header_.cols + buffer_.size() / header_.rows;
+    if(!pwriteAll((const char*)&cols, sizeof(cols), offsetof(EigHeader, cols)))
+      return false;
+    header_.cols = cols;
+    buffer_.clear();
+    return true;
+  }
+
+  template<class S>
+  bool EigAppender<S>::close()
+  {
+    if(fd_ < 0)
+      return true;
+    bool success = flush();
+    if(::close(fd_) != 0) {
+      std::cerr << "Write to " << filename_ << " failed: " << strerror(errno) << std::endl;
+      success = false;
+    }
+    fd_ = -1;
+    return success;
+  }
+
+  template<class S>
+  bool EigAppender<S>::pwriteAll(const char* buf, uint64_t num, uint64_t offset)
+  {
+    while(num > 0) {
+      ssize_t written = pwrite(fd_, buf, num, offset);
+      if(written < 0 && errno == EINTR)
+        continue;
+      if(written <= 0) {
+        std::cerr << "Write to " << filename_ << " failed: " << strerror(errno) << std::endl;
+        return false;
+      }
+      buf += written;
+      num -= written;
+      offset += written;
+    }
+    return true;
+  }
+
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_APPENDER_H
@@ -0,0 +1,115 @@
+#ifndef EIGEN_EXTENSIONS_ARCHIVE_H
+#define EIGEN_EXTENSIONS_ARCHIVE_H
+
+#include <eigen_extensions/eigen_extensions.h>
+#include <map>
+#include <sstream>
+
+namespace eigen_extensions
+{
+
+  // -- Named multi-matrix archives (.eiga).
+  //    Entries hold the usual serialize() payload for a dense or sparse
+  //    matrix, optionally deflated, and start on 64-byte boundaries.
+  //    An index of names and offsets is written at the end of the file
+  //    so that a single entry can be loaded without reading the others.
+
+  struct ArchiveEntry
+  {
+    uint64_t offset;
+    //! Bytes on disk.
+    uint64_t stored_size;
+    //! Bytes of serialize() output.
+    uint64_t size;
+    bool compressed;
+  };
+  
+  class ArchiveWriter
+  {
+  public:
+    ArchiveWriter(const std::string& filename);
+    //! Calls close() if it hasn't been called yet.
+    ~ArchiveWriter();
+    //! Appends mat under name, which must not already be in the archive.
+    //! Works for anything with a serialize() overload, i.e. dense and sparse matrices.
+    template<class MatrixType>
+    void add(const std::string& name, const MatrixType& mat, bool compress = false);
+    //! Writes the index.  No entries can be added afterwards.
+    void close();
+    
+  protected:
+    std::string filename_;
+    std::ofstream file_;
+    std::map<std::string, ArchiveEntry> index_;
+
+    void beginEntry(const std::string& name);
+    void addCompressed(const std::string& name, const std::string& data);
+    void pad();
+  };
+
+  class ArchiveReader
+  {
+  public:
+    //! Reads only the index.
+    ArchiveReader(const std::string& filename);
+    std::vector<std::string> names() const;
+    bool contains(const std::string& name) const { return index_.count(name); }
+    //! Aborts if there is no entry called name.
+    const ArchiveEntry& entry(const std::string& name) const;
+    //! Seeks to the named entry and deserializes it into mat.
+    template<class MatrixType>
+    void load(const std::string& name, MatrixType* mat);
+
+  protected:
+    std::string filename_;
+    std::ifstream file_;
+    std::map<std::string, ArchiveEntry> index_;
+
+    //! Reads and inflates the compressed entry called name.
+    void readCompressed(const std::string& name, const ArchiveEntry& entry, std::string* data);
+  };
+
+  
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+
+  template<class MatrixType>
+  void ArchiveWriter::add(const std::string& name, const MatrixType& mat, bool compress)
+  {
+    if(compress) {
+      std::ostringstream oss;
+      serialize(mat, oss);
+      addCompressed(name, oss.str());
+      return;
+    }
+
+    beginEntry(name);
+    ArchiveEntry& entry = index_[name];
+    serialize(mat, file_);
+    entry.size = (uint64_t)file_.tellp() - entry.offset;
+    entry.stored_size = entry.size;
+    assert(file_);
+  }
+
+  template<class MatrixType>
+  void ArchiveReader::load(const std::string& name, MatrixType* mat)
+  {
+    const ArchiveEntry& ent = entry(name);
+    if(ent.compressed) {
+      std::string data;
+      readCompressed(name, ent, &data);
+      std::istringstream iss(data);
+      deserialize(iss, mat);
+      return;
+    }
+
+    file_.clear();
+    file_.seekg(ent.offset);
+    deserialize(file_, mat);
+    assert(file_);
+  }
+  
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_ARCHIVE_H
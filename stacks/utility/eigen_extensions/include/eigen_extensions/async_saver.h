@@ -0,0 +1,155 @@
+#ifndef EIGEN_EXTENSIONS_ASYNC_SAVER_H
+#define EIGEN_EXTENSIONS_ASYNC_SAVER_H
+
+#include <eigen_extensions/eigen_extensions.h>
+#include <boost/thread/future.hpp>
+#include <boost/function.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <deque>
+#include <stdexcept>
+#include <errno.h>
+#include <string.h>
+
+namespace eigen_extensions
+{
+
+  //! Runs save() on background threads so the caller does not wait for
+  //! the disk or the compressor.  Each call snapshots its matrix, either
+  //! by copying it or by swapping its contents out, and returns a future
+  //! that becomes ready when the file is written.  A save that fails
+  //! throws std::runtime_error, which the future's get() rethrows.
+  //!
+  //! Snapshots count against a budget of max_bytes.  Calls block until
+  //! the snapshot fits, so memory stays bounded however fast matrices are
+  //! produced.  A single snapshot larger than the budget is let through
+  //! once nothing else is in flight.
+  class AsyncSaver : public boost::noncopyable
+  {
+  public:
+    //! Files are written in the order they were submitted when num_threads is 1.
+    AsyncSaver(uint64_t max_bytes = 1024 * 1024 * 1024, int num_threads = 1);
+    //! Waits for all pending saves.
+    ~AsyncSaver();
+
+    //! Copies mat and saves the copy.
+    template<class MatrixType>
+    boost::unique_future<void> save(const MatrixType& mat, const std::string& filename,
+                                    const SaveOptions& opts = SaveOptions());
+    //! Takes the contents of *mat by swapping, leaving it empty, so nothing is copied.
+    template<class MatrixType>
+    boost::unique_future<void> save(MatrixType* mat, const std::string& filename,
+                                    const SaveOptions& opts = SaveOptions());
+    //! Blocks until every save submitted so far has finished.
+    void wait();
+    //! Bytes of snapshots that have not been written yet.
+    uint64_t bytesInFlight() const;
+    uint64_t maxBytes() const { return max_bytes_; }
+
+  protected:
+    typedef boost::function<void()> Job;
+
+    uint64_t max_bytes_;
+    mutable boost::mutex mutex_;
+    boost::condition_variable cond_;
+    std::deque< std::pair<Job, uint64_t> > queue_;
+    uint64_t bytes_in_flight_;
+    int num_running_;
+    bool quitting_;
+    boost::thread_group threads_;
+
+    //! Blocks until bytes fit in the budget, then reserves them.
+    void reserve(uint64_t bytes);
+    //! Queues job, whose snapshot has already been reserved.
+    void push(const Job& job, uint64_t bytes);
+    void run();
+
+    template<class MatrixType>
+    boost::unique_future<void> submit(const boost::shared_ptr<MatrixType>& snapshot, uint64_t bytes,
+                                      const std::string& filename, const SaveOptions& opts);
+  };
+
+  //! The AsyncSaver used by saveAsync(): one I/O thread and a 1GB budget.
+  AsyncSaver& defaultAsyncSaver();
+
+  template<class MatrixType>
+  boost::unique_future<void> saveAsync(const MatrixType& mat, const std::string& filename,
+                                       const SaveOptions& opts = SaveOptions())
+  {
+    return defaultAsyncSaver().save(mat, filename, opts);
+  }
+
+  template<class MatrixType>
+  boost::unique_future<void> saveAsync(MatrixType* mat, const std::string& filename,
+                                       const SaveOptions& opts = SaveOptions())
+  {
+    return defaultAsyncSaver().save(mat, filename, opts);
+  }
+
+
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+
+  //! Bytes of memory held by a snapshot.
+  template<class S, int T, int U, int O>
+  uint64_t snapshotBytes(const Eigen::Matrix<S, T, U, O>& mat)
+  {
+    return sizeof(S) * mat.size();
+  }
+
+  template<class ScalarType, int Options, class IndexType>
+  uint64_t snapshotBytes(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat)
+  {
+    return (sizeof(ScalarType) + sizeof(IndexType)) * mat.nonZeros() + sizeof(IndexType) * (mat.outerSize() + 1);
+  }
+
+  //! Throws so that the packaged_task hands the failure to the future.
+  template<class MatrixType>
+  void saveSnapshot(const boost::shared_ptr<MatrixType>& snapshot, const std::string& filename,
+                    const SaveOptions& opts)
+  {
+    errno = 0;
+    if(!eigen_extensions::save(*snapshot, filename, opts)) {
+      std::string reason = errno ? strerror(errno) : "write failed";
+      throw std::runtime_error("Could not save " + filename + ": " + reason);
+    }
+  }
+
+  template<class MatrixType>
+  boost::unique_future<void> AsyncSaver::save(const MatrixType& mat, const std::string& filename,
+                                              const SaveOptions& opts)
+  {
+    // -- Wait for room before making the copy, not after.
+    uint64_t bytes = snapshotBytes(mat);
+    reserve(bytes);
+    boost::shared_ptr<MatrixType> snapshot(new MatrixType(mat));
+    return submit(snapshot, bytes, filename, opts);
+  }
+
+  template<class MatrixType>
+  boost::unique_future<void> AsyncSaver::save(MatrixType* mat, const std::string& filename,
+                                              const SaveOptions& opts)
+  {
+    uint64_t bytes = snapshotBytes(*mat);
+    reserve(bytes);
+    boost::shared_ptr<MatrixType> snapshot(new MatrixType);
+    snapshot->swap(*mat);
+    return submit(snapshot, bytes, filename, opts);
+  }
+
+  template<class MatrixType>
+  boost::unique_future<void> AsyncSaver::submit(const boost::shared_ptr<MatrixType>& snapshot, uint64_t bytes,
+                                                const std::string& filename, const SaveOptions& opts)
+  {
+    typedef boost::packaged_task<void> Task;
+    boost::shared_ptr<Task> task(new Task(boost::bind(&saveSnapshot<MatrixType>, snapshot, filename, opts)));
+    boost::unique_future<void> future = task->get_future();
+    push(boost::bind(&Task::operator(), task), bytes);
+    // Written out so the C++03 move emulation accepts it.
+    return boost::unique_future<void>(boost::move(future));
+  }
+
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_ASYNC_SAVER_H
@@ -0,0 +1,129 @@
+#ifndef EIGEN_EXTENSIONS_BLOCK_READER_H
+#define EIGEN_EXTENSIONS_BLOCK_READER_H
+
+#include <eigen_extensions/eigen_extensions.h>
+
+namespace eigen_extensions
+{
+
+  //! Streams a .eig, .eig.gz, .eig.lz4 or .eig.zst file in fixed-size
+  //! blocks of stored vectors: blocks of columns for column-major files and
+  //! blocks of rows for row-major files.  Matrices larger than RAM can then
+  //! be processed in constant memory.  Only the header is read on
+  //! construction.  Encoded, shuffled and other-typed files are decoded
+  //! into S as load() would.
+  template<class S>
+  class EigBlockReader
+  {
+  public:
+    typedef Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic> MatrixType;
+    
+    EigBlockReader(const std::string& filename, int block_size);
+    ~EigBlockReader();
+    const EigHeader& header() const { return header_; }
+    int64_t rows() const { return header_.rows; }
+    int64_t cols() const { return header_.cols; }
+    //! True if blocks are rows rather than columns.
+    bool rowMajor() const { return header_.rowMajor(); }
+    //! Index of the first column, or row for row-major files, that the next call to next() will return.
+    int64_t position() const { return position_; }
+    //! Reads up to block_size columns, or rows for row-major files, into block,
+    //! resizing it only if its shape changes.  Returns false once all have been read.
+    bool next(MatrixType* block);
+    
+  protected:
+    std::string filename_;
+    int block_size_;
+    EigHeader header_;
+    int64_t position_;
+    std::ifstream file_;
+    igzstream gzfile_;
+    CodecIstream codecfile_;
+    std::istream* strm_;
+    //! Rows as stored, before they are copied into a column-major block.
+    std::vector<S> rows_;
+  };
+
+  
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+
+  template<class S>
+  EigBlockReader<S>::EigBlockReader(const std::string& filename, int block_size) :
+    filename_(filename),
+    block_size_(block_size),
+    position_(0),
+    strm_(NULL)
+  {
+    assert(block_size_ > 0);
+    if(filename.size() > 3 && filename.substr(filename.size() - 3, 3).compare(".gz") == 0) {
+      gzfile_.open(filename.c_str());
+      strm_ = &gzfile_;
+    }
+    else if(codecForFilename(filename) != EIG_CODEC_NONE) {
+      codecfile_.open(filename);
+      strm_ = &codecfile_;
+    }
+    else if(boost::filesystem::extension(filename).compare(".eig") == 0) {
+      file_.open(filename.c_str(), std::ios::in | std::ios::binary);
+      strm_ = &file_;
+    }
+    else {
+      std::cerr << "EigBlockReader cannot read " << filename << ".  It must end in .eig, .eig.gz, .eig.lz4 or .eig.zst." << std::endl;
+      abort();
+    }
+    if(!*strm_) {
+      std::cerr << "File " << filename << " could not be opened." << std::endl;
+      abort();
+    }
+
+    deserializeHeader(*strm_, &header_);
+    if(!*strm_) {
+      std::cerr << filename << " is too short for a .eig header." << std::endl;
+      abort();
+    }
+    // -- Aborts on files that cannot be converted to S.  The rest are
+    //    decoded a block at a time by readVectors().
+    checkHeader(header_, MatrixType());
+  }
+
+  template<class S>
+  EigBlockReader<S>::~EigBlockReader()
+  {
+    if(strm_ == &gzfile_)
+      gzfile_.close();
+    else if(strm_ == &codecfile_)
+      codecfile_.close();
+    else
+      file_.close();
+  }
+
+  template<class S>
+  bool EigBlockReader<S>::next(MatrixType* block)
+  {
+    if(position_ >= header_.outerSize())
+      return false;
+
+    int64_t num = std::min<int64_t>(block_size_, header_.outerSize() - position_);
+    if(header_.rowMajor()) {
+      rows_.resize(num * header_.cols);
+      readVectors(*strm_, header_, num, rows_.empty() ? NULL : &rows_[0]);
+      typedef Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorType;
+      *block = Eigen::Map<const RowMajorType>(rows_.empty() ? NULL : &rows_[0], num, header_.cols);
+    }
+    else {
+      block->resize(header_.rows, num);
+      readVectors(*strm_, header_, num, block->data());
+    }
+    if(!*strm_) {
+      std::cerr << filename_ << " is truncated at stored vector " << position_ << "." << std::endl;
+      abort();
+    }
+    position_ += num;
+    return true;
+  }
+  
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_BLOCK_READER_H
@@ -0,0 +1,153 @@
+#ifndef EIGEN_EXTENSIONS_CODECS_H
+#define EIGEN_EXTENSIONS_CODECS_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+
+namespace eigen_extensions
+{
+
+  // -- Codec stream files.
+  //    A 16-byte header (CODEC_MAGIC, int32 codec id, uint64 block size)
+  //    followed by independently compressed blocks, each prefixed by its
+  //    uint32 uncompressed and stored lengths.  A block whose stored
+  //    length has CODEC_STORED_BIT set holds raw bytes because compression
+  //    did not help.  A block with zero uncompressed length ends the stream.
+
+  const char CODEC_MAGIC[4] = {'\x89', 'E', 'I', 'C'};
+  const int CODEC_HEADER_SIZE = 16;
+  const uint32_t CODEC_STORED_BIT = 0x80000000u;
+
+  //! Ids of the built-in codecs.  Never renumber these.
+  enum EigCodec
+  {
+    EIG_CODEC_NONE = 0,
+    EIG_CODEC_LZ4 = 1,
+    EIG_CODEC_ZSTD = 2
+  };
+
+  //! Compresses independent blocks.  Must be safe to call from several threads at once.
+  class Codec
+  {
+  public:
+    virtual ~Codec() {}
+    virtual const char* name() const = 0;
+    //! Files ending in this, e.g. ".lz4", use this codec by default.
+    virtual const char* extension() const = 0;
+    //! Level used in place of Z_DEFAULT_COMPRESSION.
+    virtual int defaultLevel() const = 0;
+    //! Largest possible compressed size of len bytes.
+    virtual size_t bound(size_t len) const = 0;
+    //! Compresses len bytes of src into dest, which has room for bound(len) bytes.
+    //! Returns the compressed size, or 0 on failure.
+    virtual size_t compress(const char* src, size_t len, char* dest, size_t dest_len, int level) const = 0;
+    //! Returns true if src decompressed to exactly dest_len bytes.
+    virtual bool decompress(const char* src, size_t len, char* dest, size_t dest_len) const = 0;
+  };
+
+  //! Makes codec available under id for reading and writing.  codec must
+  //! outlive its use.  Register custom codecs with ids of 256 and up.
+  void registerCodec(int id, const Codec* codec);
+  //! Returns NULL if no codec is registered under id, e.g. because the
+  //! library was built without it.
+  const Codec* findCodec(int id);
+  //! Id of the codec whose extension filename ends with, or EIG_CODEC_NONE.
+  int codecForFilename(const std::string& filename);
+  //! True if filename starts with a codec stream header.
+  bool isCodecFile(const std::string& filename);
+
+  //! Writes a codec stream, compressing batches of blocks on num_threads threads.
+  class CodecOstreambuf : public std::streambuf
+  {
+  public:
+    CodecOstreambuf();
+    ~CodecOstreambuf();
+    //! num_threads <= 0 means use all cores.  Returns NULL if the file
+    //! cannot be opened or the codec is not available.
+    CodecOstreambuf* open(const std::string& filename, int codec_id, int level, int num_threads,
+                          size_t block_size = 1024 * 1024);
+    CodecOstreambuf* close();
+    bool is_open() const { return opened_; }
+
+  protected:
+    virtual int overflow(int c);
+
+  private:
+    std::ofstream file_;
+    bool opened_;
+    const Codec* codec_;
+    int level_;
+    int num_threads_;
+    size_t block_size_;
+    std::vector<char> buffer_;
+    std::vector<std::string> compressed_;
+
+    bool flushBatch();
+    void compressBlocks(const char* data, size_t len, size_t num_blocks, int thread_id);
+  };
+
+  class CodecOstream : public std::ostream
+  {
+  public:
+    //! level is Z_DEFAULT_COMPRESSION for the codec's default.
+    CodecOstream(const std::string& filename, int codec_id, int level, int num_threads = 0);
+    ~CodecOstream();
+    void close();
+
+  protected:
+    CodecOstreambuf buf_;
+  };
+
+  //! Reads a codec stream, decompressing batches of blocks on num_threads threads.
+  class CodecIstreambuf : public std::streambuf
+  {
+  public:
+    CodecIstreambuf();
+    //! num_threads <= 0 means use all cores.  Returns NULL if the file
+    //! cannot be opened, is not a codec stream, or uses an unavailable codec.
+    CodecIstreambuf* open(const std::string& filename, int num_threads = 0);
+    void close();
+    bool is_open() const { return file_.is_open(); }
+
+  protected:
+    virtual int underflow();
+
+  private:
+    std::string filename_;
+    std::ifstream file_;
+    const Codec* codec_;
+    int num_threads_;
+    uint64_t block_size_;
+    bool finished_;
+    //! Decompressed data of the current batch.
+    std::vector<char> buffer_;
+    //! Per-block state of the current batch.
+    size_t num_blocks_;
+    std::vector<std::string> compressed_;
+    std::vector<uint32_t> raw_sizes_;
+    std::vector<char> stored_;
+    std::vector<uint64_t> offsets_;
+    std::vector<char> valid_;
+
+    bool readBatch();
+    void decompressBlocks(int thread_id);
+  };
+
+  class CodecIstream : public std::istream
+  {
+  public:
+    CodecIstream();
+    CodecIstream(const std::string& filename, int num_threads = 0);
+    void open(const std::string& filename, int num_threads = 0);
+    void close();
+
+  protected:
+    CodecIstreambuf buf_;
+  };
+
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_CODECS_H
@@ -7,47 +7,331 @@
 #define BOOST_FILESYSTEM_VERSION 2
 #include <boost/filesystem.hpp>
 #include <stdint.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <fstream>
 #include <iostream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/static_assert.hpp>
+#include <boost/type_traits.hpp>
+#include <boost/mpl/if.hpp>
 #include <gzstream/gzstream.h>
+#include <eigen_extensions/parallel_gzip.h>
+#include <eigen_extensions/filters.h>
+#include <eigen_extensions/encodings.h>
+#include <eigen_extensions/codecs.h>
+#include <eigen_extensions/file_writer.h>
 
 namespace eigen_extensions {
 
-  template<class S, int T, int U>
-  void save(const Eigen::Matrix<S, T, U>& mat, const std::string& filename);
+  // -- Dense matrix file header.
+  //    Version 1 files start with three ints: bytes, rows, cols.
+  //    Version 2 files start with EIG_MAGIC and a fixed-size header
+  //    so that the payload is 64-byte aligned when the file is mmapped.
+  //    All sizes are 64-bit.
 
-  template<class S, int T, int U>
-  void load(const std::string& filename, Eigen::Matrix<S, T, U>* mat);
+  const char EIG_MAGIC[4] = {'\x89', 'E', 'I', 'G'};
+  const int EIG_VERSION = 2;
+  const int EIG_HEADER_SIZE = 64;
 
+  //! Values of EigHeader::scalar_type.  Never renumber these.
+  enum EigScalarType
+  {
+    EIG_UNKNOWN_TYPE = 0,
+    EIG_INT8 = 1,
+    EIG_UINT8 = 2,
+    EIG_INT16 = 3,
+    EIG_UINT16 = 4,
+    EIG_INT32 = 5,
+    EIG_UINT32 = 6,
+    EIG_INT64 = 7,
+    EIG_UINT64 = 8,
+    EIG_FLOAT32 = 9,
+    EIG_FLOAT64 = 10
+  };
+
+  //! Bits of EigHeader::flags.
+  enum EigFlags
+  {
+    //! Payload is stored row by row.
+    EIG_ROW_MAJOR = 1,
+    //! Sparse only: inner indices are stored as delta-coded varints
+    //! and the outer index is implied by per-vector counts.
+    EIG_PACKED_INDICES = 2,
+    //! Values are byte-shuffled; see shuffleBytes().
+    EIG_SHUFFLED = 4
+  };
+  
+  template<class S> struct EigScalarTraits { static const int type = EIG_UNKNOWN_TYPE; };
+  template<> struct EigScalarTraits<int8_t> { static const int type = EIG_INT8; };
+  template<> struct EigScalarTraits<uint8_t> { static const int type = EIG_UINT8; };
+  template<> struct EigScalarTraits<int16_t> { static const int type = EIG_INT16; };
+  template<> struct EigScalarTraits<uint16_t> { static const int type = EIG_UINT16; };
+  template<> struct EigScalarTraits<int32_t> { static const int type = EIG_INT32; };
+  template<> struct EigScalarTraits<uint32_t> { static const int type = EIG_UINT32; };
+  template<> struct EigScalarTraits<int64_t> { static const int type = EIG_INT64; };
+  template<> struct EigScalarTraits<uint64_t> { static const int type = EIG_UINT64; };
+  template<> struct EigScalarTraits<float> { static const int type = EIG_FLOAT32; };
+  template<> struct EigScalarTraits<double> { static const int type = EIG_FLOAT64; };
+
+  //! e.g. "float32".  Returns "unknown" for EIG_UNKNOWN_TYPE and unrecognized values.
+  const char* scalarTypeName(int scalar_type);
+  
+  struct EigHeader
+  {
+    char magic[4];
+    int32_t version;
+    //! Bytes per stored element.  sizeof(Scalar) unless encoding is set.
+    int32_t bytes;
+    //! EigScalarType of the saved matrix.  Always EIG_UNKNOWN_TYPE for version 1.
+    int32_t scalar_type;
+    int64_t rows;
+    int64_t cols;
+    //! EigFlags.  Version 1 files are always column-major.
+    int32_t flags;
+    //! EigEncoding of the payload.
+    int32_t encoding;
+    char reserved[24];
+
+    EigHeader();
+    bool rowMajor() const { return flags & EIG_ROW_MAJOR; }
+    //! Number and length of the stored vectors, i.e. columns for column-major.
+    int64_t outerSize() const { return rowMajor() ? rows : cols; }
+    int64_t innerSize() const { return rowMajor() ? cols : rows; }
+    //! Bytes of one stored vector, including any encoding parameters.
+    uint64_t vectorSize() const;
+    //! Number of bytes in the payload that follows the header.
+    uint64_t payloadSize() const { return vectorSize() * outerSize(); }
+    //! Number of bytes of header preceding the payload in the file.
+    int dataOffset() const { return (version == 1) ? 3 * sizeof(int) : EIG_HEADER_SIZE; }
+  };
+  
+  void serializeHeader(const EigHeader& header, std::ostream& strm);
+  //! Reads either a version 1 or version 2 header.
+  void deserializeHeader(std::istream& strm, EigHeader* header);
+  //! Parses a header from the start of an in-memory buffer of at least len bytes.
+  //! Returns false if the buffer is too short.
+  bool parseHeader(const char* buf, uint64_t len, EigHeader* header);
+  
+  // -- Sparse matrix file header.
+  //    Version 1 files start with five ints: bytes, options, outer, inner, nnz,
+  //    followed by (count, (index, value)...) for each outer vector.
+  //    Version 2 files start with EIG_SPARSE_MAGIC and a fixed-size header,
+  //    followed by the compressed outer index, inner index, and value arrays.
+  //    Each array starts on a 64-byte boundary.
+
+  const char EIG_SPARSE_MAGIC[4] = {'\x89', 'E', 'I', 'S'};
+  const int EIG_ALIGNMENT = 64;
+
+  struct EigSparseHeader
+  {
+    char magic[4];
+    int32_t version;
+    //! sizeof(Scalar).
+    int32_t bytes;
+    //! EigScalarType.
+    int32_t scalar_type;
+    //! sizeof(StorageIndex) of the index arrays.
+    int32_t index_bytes;
+    //! EigFlags.
+    int32_t flags;
+    int64_t outer;
+    int64_t inner;
+    int64_t nnz;
+    char reserved[16];
+
+    EigSparseHeader();
+    bool rowMajor() const { return flags & EIG_ROW_MAJOR; }
+    //! Offsets of the three arrays relative to the start of the header.  Version 2 only.
+    uint64_t outerIndexOffset() const { return EIG_HEADER_SIZE; }
+    uint64_t innerIndexOffset() const;
+    uint64_t valueOffset() const;
+    //! Total serialized size including the header.  Version 2 only.
+    uint64_t size() const { return valueOffset() + (uint64_t)bytes * nnz; }
+  };
+
+  //! Number of zero bytes needed after num bytes to reach an EIG_ALIGNMENT boundary.
+  inline uint64_t alignmentPadding(uint64_t num) { return (EIG_ALIGNMENT - num % EIG_ALIGNMENT) % EIG_ALIGNMENT; }
+  
+  void serializeHeader(const EigSparseHeader& header, std::ostream& strm);
+  //! Reads either a version 1 or version 2 sparse header.
+  void deserializeHeader(std::istream& strm, EigSparseHeader* header);
+  //! Parses a version 2 sparse header from an in-memory buffer of at least len bytes.
+  //! Returns false if the buffer does not start with one.
+  bool parseHeader(const char* buf, uint64_t len, EigSparseHeader* header);
+  
+  //! Per-call settings for save().
+  struct SaveOptions
+  {
+    //! Number of threads used to compress .gz and codec files.  0 means use all cores.
+    int num_threads;
+    //! Compression level for .gz and codec files.  Z_DEFAULT_COMPRESSION
+    //! selects each codec's own default.
+    int level;
+    //! EigCodec used to compress the file whatever its extension, except
+    //! that save() refuses .gz names, which load() would read as gzip.
+    //! EIG_CODEC_NONE chooses by extension: .lz4, .zst, .gz, or none.
+    int codec;
+    //! Write .gz files as independently compressed gzip members plus an
+    //! index, so load() can inflate in parallel and loadCols() can
+    //! decompress only the columns it needs.  Still readable by gunzip.
+    bool blocked_gzip;
+    //! Sparse only: store inner indices as delta-coded varints.  Typically
+    //! a quarter of the size of raw indices, but the file cannot be mmapped.
+    bool packed_indices;
+    //! Byte-shuffle the values so they compress better.  Dense matrices
+    //! are shuffled one stored vector at a time and can no longer be mmapped.
+    bool shuffle;
+    //! Dense float and double only: EigEncoding of the saved payload.
+    //! Anything other than EIG_RAW is lossy.
+    int encoding;
+    //! Uncompressed .eig only: bypass the page cache with O_DIRECT, so
+    //! that saving a large matrix does not evict everything else.
+    bool direct_io;
+    //! Uncompressed .eig only: reserve the whole file with fallocate
+    //! before writing, which reduces fragmentation.
+    bool preallocate;
+
+    SaveOptions() :
+      num_threads(0),
+      level(Z_DEFAULT_COMPRESSION),
+      codec(EIG_CODEC_NONE),
+      blocked_gzip(false),
+      packed_indices(false),
+      shuffle(false),
+      encoding(EIG_RAW),
+      direct_io(false),
+      preallocate(false)
+    {
+    }
+  };
+  
+  //! Returns false, after printing why, if the file could not be written.
+  template<class S, int T, int U, int O>
+  bool save(const Eigen::Matrix<S, T, U, O>& mat, const std::string& filename,
+            const SaveOptions& opts = SaveOptions());
+
+  template<class S, int T, int U, int O>
+  void load(const std::string& filename, Eigen::Matrix<S, T, U, O>* mat);
+
+  //! Loads columns [begin, end) of a column-major matrix.
+  //! .eig files and blocked .eig.gz files read only the requested columns.
+  //! Other compressed files are decompressed up to the last requested column.
+  template<class S, int T, int U, int O>
+  void loadCols(const std::string& filename, int64_t begin, int64_t end, Eigen::Matrix<S, T, U, O>* mat);
+
+  //! Loads the listed columns, in order, into the columns of mat.
+  //! Indices may repeat and need not be sorted; runs of consecutive
+  //! indices are read with a single seek.
+  template<class S, int T, int U, int O>
+  void loadCols(const std::string& filename, const std::vector<int64_t>& indices, Eigen::Matrix<S, T, U, O>* mat);
+  
+  //! .eig, .eig.gz, .eig.lz4, or .eig.zst.
+  //! Returns false, after printing why, if the file could not be written.
   template<class ScalarType, int Options, class IndexType>
-  void save(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, const std::string& filename);
+  bool save(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, const std::string& filename,
+            const SaveOptions& opts = SaveOptions());
 
   template<class ScalarType, int Options, class IndexType>
   void load(const std::string& filename, Eigen::SparseMatrix<ScalarType, Options, IndexType>* mat);
   
-  template<class S, int T, int U>
-  void saveASCII(const Eigen::Matrix<S, T, U>& mat, const std::string& filename);
+  template<class S, int T, int U, int O>
+  void saveASCII(const Eigen::Matrix<S, T, U, O>& mat, const std::string& filename);
 
-  template<class S, int T, int U>
-  void loadASCII(const std::string& filename, Eigen::Matrix<S, T, U>* mat);
+  template<class S, int T, int U, int O>
+  void loadASCII(const std::string& filename, Eigen::Matrix<S, T, U, O>* mat);
+  
+  //! Writes a header and the payload, using opts.encoding.  This is the
+  //! format of .eig files, for fixed-size matrices too.
+  template<class S, int T, int U, int O>
+  void serialize(const Eigen::Matrix<S, T, U, O>& mat, std::ostream& strm,
+                 const SaveOptions& opts = SaveOptions());
+  
+  template<class S, int T, int U, int O>
+  void deserialize(std::istream& strm, Eigen::Matrix<S, T, U, O>* mat);
   
-  template<class S, int T, int U>
-  void serialize(const Eigen::Matrix<S, T, U>& mat, std::ostream& strm);
+  //! Writes only the coefficients of a fixed-size matrix, with no header.
+  //! The shape is part of the type, so it is checked at compile time rather
+  //! than stored.  Not readable by deserialize().
+  template<class S, int T, int U, int O>
+  void serializeFixed(const Eigen::Matrix<S, T, U, O>& mat, std::ostream& strm);
+
+  template<class S, int T, int U, int O>
+  void deserializeFixed(std::istream& strm, Eigen::Matrix<S, T, U, O>* mat);
+
+  //! Writes a std::vector of fixed-size matrices as a count followed by
+  //! all the coefficients in a single write.  Typically used with
+  //! Eigen::aligned_allocator.
+  template<class S, int T, int U, int O, class Allocator>
+  void serialize(const std::vector<Eigen::Matrix<S, T, U, O>, Allocator>& vec, std::ostream& strm);
+
+  template<class S, int T, int U, int O, class Allocator>
+  void deserialize(std::istream& strm, std::vector<Eigen::Matrix<S, T, U, O>, Allocator>* vec);
+
+  //! Inflates the whole matrix in parallel.
+  template<class S, int T, int U, int O>
+  void deserialize(const BlockedGzipReader& reader, Eigen::Matrix<S, T, U, O>* mat);
+
+  template<class S, int T, int U, int O>
+  void serializeASCII(const Eigen::Matrix<S, T, U, O>& mat, std::ostream& strm);
   
-  template<class S, int T, int U>
-  void deserialize(std::istream& strm, Eigen::Matrix<S, T, U>* mat);
+  template<class S, int T, int U, int O>
+  void deserializeASCII(std::istream& strm, Eigen::Matrix<S, T, U, O>* mat);  
+
+  //! Parses an entire ASCII-serialized matrix held in memory.
+  //! Large inputs are split at line boundaries and parsed on num_threads threads.
+  //! num_threads <= 0 means use all cores.
+  template<class S, int T, int U, int O>
+  void deserializeASCII(const std::string& buf, Eigen::Matrix<S, T, U, O>* mat, int num_threads = 0);
 
-  template<class S, int T, int U>
-  void serializeASCII(const Eigen::Matrix<S, T, U>& mat, std::ostream& strm);
   
-  template<class S, int T, int U>
-  void deserializeASCII(std::istream& strm, Eigen::Matrix<S, T, U>* mat);  
+  // -- ASCII scalar conversion.
+  //    These avoid iostreams and do not allocate.
+
+  //! Parses one number starting at str, skipping leading whitespace.
+  //! Sets *end to the first unparsed character.  Types other than built-in
+  //! integers and floating point, e.g. std::complex, are read with operator>>
+  //! from the next whitespace-delimited token.
+  //! Like formatASCIIScalar(), this uses the C library's number functions,
+  //! which follow LC_NUMERIC.  .eig.txt files use '.', so programs that call
+  //! setlocale() should leave LC_NUMERIC as "C".
+  template<class T>
+  void parseASCIIScalar(const char* str, const char** end, T* val);
+  void parseASCIIScalar(const char* str, const char** end, double* val);
+  void parseASCIIScalar(const char* str, const char** end, float* val);
+  void parseASCIIScalar(const char* str, const char** end, int* val);
+
+  //! Writes val with the fewest digits that parse back exactly, e.g.
+  //! 0.1 rather than 0.10000000000000001.
+  //! buf must hold at least ASCII_SCALAR_BUFFER_SIZE chars.  Returns the length written.
+  //! T must be a built-in integer or floating point type; see appendASCIIScalar().
+  const int ASCII_SCALAR_BUFFER_SIZE = 32;
+  template<class T>
+  int formatASCIIScalar(T val, char* buf);
+  int formatASCIIScalar(double val, char* buf);
+  int formatASCIIScalar(float val, char* buf);
+  int formatASCIIScalar(int val, char* buf);
+
+  //! Appends val as formatASCIIScalar() would, or with operator<< at full
+  //! precision for types it does not handle.
+  template<class T>
+  void appendASCIIScalar(const T& val, std::string* str);
 
   
   // -- SparseMatrix serialization.
   
+  //! Uses opts.packed_indices and opts.shuffle.
   template<class ScalarType, int Options, class IndexType>
-  void serialize(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, std::ostream& strm);
+  void serialize(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, std::ostream& strm,
+                 const SaveOptions& opts = SaveOptions());
 
   template<class ScalarType, int Options, class IndexType>
   void deserialize(std::istream& strm, Eigen::SparseMatrix<ScalarType, Options, IndexType>* mat);
@@ -64,67 +348,593 @@ namespace eigen_extensions {
 
 
   /************************************************************
-   * Template implementations
+   * Header implementations
    ************************************************************/
+
+  inline EigHeader::EigHeader() :
+    version(EIG_VERSION),
+    bytes(0),
+    scalar_type(EIG_UNKNOWN_TYPE),
+    rows(0),
+    cols(0),
+    flags(0),
+    encoding(EIG_RAW)
+  {
+    memcpy(magic, EIG_MAGIC, sizeof(magic));
+    memset(reserved, 0, sizeof(reserved));
+  }
+  
+  inline const char* scalarTypeName(int scalar_type)
+  {
+    static const char* names[] = {"unknown", "int8", "uint8", "int16", "uint16", "int32", "uint32",
+                                  "int64", "uint64", "float32", "float64"};
+    if(scalar_type < 0 || scalar_type > EIG_FLOAT64)
+      return names[EIG_UNKNOWN_TYPE];
+    return names[scalar_type];
+  }
+
+  inline uint64_t EigHeader::vectorSize() const
+  {
+    uint64_t num = (uint64_t)bytes * innerSize();
+    if(encoding == EIG_AFFINE_INT8)
+      num += EIG_AFFINE_PARAMS_SIZE;
+    return num;
+  }
   
-  template<class S, int T, int U>
-  void serialize(const Eigen::Matrix<S, T, U>& mat, std::ostream& strm)
+  //! True if the payload can be copied straight into the memory of a matrix of S.
+  //! Otherwise it must be decoded or converted.
+  template<class S>
+  bool isDirectlyReadable(const EigHeader& header)
+  {
+    return header.encoding == EIG_RAW && !(header.flags & EIG_SHUFFLED) && header.bytes == sizeof(S) &&
+      (header.scalar_type == EIG_UNKNOWN_TYPE || EigScalarTraits<S>::type == EIG_UNKNOWN_TYPE ||
+       header.scalar_type == EigScalarTraits<S>::type);
+  }
+  
+  //! Checks that a file with this header can be read into a Matrix<S, T, U, O>.
+  //! Aborts with a message if it cannot, rather than reading garbage.
+  template<class S, int T, int U, int O>
+  void checkHeader(const EigHeader& header, const Eigen::Matrix<S, T, U, O>&)
+  {
+    if(header.encoding != EIG_RAW &&
+       (encodedBytes(header.encoding) == 0 || header.bytes != encodedBytes(header.encoding))) {
+      std::cerr << "Header has unknown encoding " << header.encoding << " or "
+                << header.bytes << " bytes per coefficient, which does not match it." << std::endl;
+      abort();
+    }
+    
+    // -- Conversion needs to know both types.  Version 1 files don't record theirs.
+    if(!isDirectlyReadable<S>(header) &&
+       (header.scalar_type == EIG_UNKNOWN_TYPE || EigScalarTraits<S>::type == EIG_UNKNOWN_TYPE)) {
+      std::cerr << "Cannot load a " << scalarTypeName(header.scalar_type) << " matrix into a "
+                << scalarTypeName(EigScalarTraits<S>::type) << " matrix." << std::endl;
+      abort();
+    }
+
+    if((T != Eigen::Dynamic && T != header.rows) || (U != Eigen::Dynamic && U != header.cols)) {
+      std::cerr << "Cannot load a " << header.rows << " x " << header.cols << " matrix into a "
+                << T << " x " << U << " matrix." << std::endl;
+      abort();
+    }
+  }
+
+  //! True if a file with this header must be transposed on its way into a Matrix<S, T, U, O>.
+  //! Vectors are laid out the same either way.
+  template<class S, int T, int U, int O>
+  bool needsTranspose(const EigHeader& header, const Eigen::Matrix<S, T, U, O>&)
   {
-    int bytes = sizeof(S);
-    int rows = mat.rows();
-    int cols = mat.cols();
-    strm.write((char*)&bytes, sizeof(int));
-    strm.write((char*)&rows, sizeof(int));
-    strm.write((char*)&cols, sizeof(int));
-    strm.write((const char*)mat.data(), sizeof(S) * rows * cols);
+    bool row_major = Eigen::Matrix<S, T, U, O>::IsRowMajor;
+    return header.rowMajor() != row_major && header.rows > 1 && header.cols > 1;
   }
   
-  template<class S, int T, int U>
-  void deserialize(std::istream& strm, Eigen::Matrix<S, T, U>* mat)
+  inline EigSparseHeader::EigSparseHeader() :
+    version(EIG_VERSION),
+    bytes(0),
+    scalar_type(EIG_UNKNOWN_TYPE),
+    index_bytes(0),
+    flags(0),
+    outer(0),
+    inner(0),
+    nnz(0)
   {
+    memcpy(magic, EIG_SPARSE_MAGIC, sizeof(magic));
+    memset(reserved, 0, sizeof(reserved));
+  }
+
+  inline uint64_t EigSparseHeader::innerIndexOffset() const
+  {
+    uint64_t end = outerIndexOffset() + (uint64_t)index_bytes * (outer + 1);
+    return end + alignmentPadding(end);
+  }
+
+  inline uint64_t EigSparseHeader::valueOffset() const
+  {
+    uint64_t end = innerIndexOffset() + (uint64_t)index_bytes * nnz;
+    return end + alignmentPadding(end);
+  }
+  
+  inline void serializeHeader(const EigSparseHeader& header, std::ostream& strm)
+  {
+    assert(sizeof(EigSparseHeader) == EIG_HEADER_SIZE);
+    assert(header.version == EIG_VERSION);
+    strm.write((const char*)&header, sizeof(EigSparseHeader));
+  }
+
+  inline void deserializeHeader(std::istream& strm, EigSparseHeader* header)
+  {
+    strm.read(header->magic, sizeof(header->magic));
+    if(memcmp(header->magic, EIG_SPARSE_MAGIC, sizeof(EIG_SPARSE_MAGIC)) == 0) {
+      strm.read(((char*)header) + sizeof(header->magic), sizeof(EigSparseHeader) - sizeof(header->magic));
+      assert(header->version == EIG_VERSION);
+      return;
+    }
+
+    // -- Version 1: the four bytes we just read were the scalar size.
+    int v1[5];
+    memcpy(&v1[0], header->magic, sizeof(int));
+    strm.read((char*)&v1[1], 4 * sizeof(int));
+    *header = EigSparseHeader();
+    header->version = 1;
+    header->bytes = v1[0];
+    header->flags = (v1[1] & Eigen::RowMajorBit) ? EIG_ROW_MAJOR : 0;
+    header->outer = v1[2];
+    header->inner = v1[3];
+    header->nnz = v1[4];
+  }
+  
+  inline bool parseHeader(const char* buf, uint64_t len, EigSparseHeader* header)
+  {
+    if(len < sizeof(EigSparseHeader) || memcmp(buf, EIG_SPARSE_MAGIC, sizeof(EIG_SPARSE_MAGIC)) != 0)
+      return false;
+    memcpy(header, buf, sizeof(EigSparseHeader));
+    return true;
+  }
+  
+  inline void serializeHeader(const EigHeader& header, std::ostream& strm)
+  {
+    assert(sizeof(EigHeader) == EIG_HEADER_SIZE);
+    assert(header.version == EIG_VERSION);
+    strm.write((const char*)&header, sizeof(EigHeader));
+  }
+
+  inline void deserializeHeader(std::istream& strm, EigHeader* header)
+  {
+    strm.read(header->magic, sizeof(header->magic));
+    if(memcmp(header->magic, EIG_MAGIC, sizeof(EIG_MAGIC)) == 0) {
+      strm.read(((char*)header) + sizeof(header->magic), sizeof(EigHeader) - sizeof(header->magic));
+      assert(header->version == EIG_VERSION);
+      return;
+    }
+
+    // -- Version 1: the four bytes we just read were the scalar size.
     int bytes;
     int rows;
     int cols;
-    strm.read((char*)&bytes, sizeof(int));
+    memcpy(&bytes, header->magic, sizeof(int));
     strm.read((char*)&rows, sizeof(int));
     strm.read((char*)&cols, sizeof(int));
-    assert(bytes == sizeof(S));
-      
-    S *buf = (S*) malloc(sizeof(S) * rows * cols);
-    strm.read((char*)buf, sizeof(S) * rows * cols);
-    *mat = Eigen::Map< Eigen::Matrix<S, T, U> >(buf, rows, cols);
-    free(buf);    
+    *header = EigHeader();
+    header->version = 1;
+    header->bytes = bytes;
+    header->rows = rows;
+    header->cols = cols;
+  }
+
+  inline bool parseHeader(const char* buf, uint64_t len, EigHeader* header)
+  {
+    if(len >= sizeof(EigHeader) && memcmp(buf, EIG_MAGIC, sizeof(EIG_MAGIC)) == 0) {
+      memcpy(header, buf, sizeof(EigHeader));
+      return true;
+    }
+    if(len < 3 * sizeof(int))
+      return false;
+
+    int v1[3];
+    memcpy(v1, buf, sizeof(v1));
+    *header = EigHeader();
+    header->version = 1;
+    header->bytes = v1[0];
+    header->rows = v1[1];
+    header->cols = v1[2];
+    return true;
+  }
+  
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+  
+  //! Number of floats converted at a time by encodeVector() and decodeVector().
+  const int ENCODING_CHUNK_SIZE = 1024;
+  //! Bytes of source data converted at a time when loading into a different scalar type.
+  const uint64_t CONVERSION_CHUNK_SIZE = 1 << 22;
+
+  template<class From, class S>
+  void convertScalars(const From* src, uint64_t num, S* dst)
+  {
+    // Eigen vectorizes the cast where the architecture allows.
+    Eigen::Map< Eigen::Matrix<S, Eigen::Dynamic, 1> > out(dst, num);
+    out = Eigen::Map< const Eigen::Matrix<From, Eigen::Dynamic, 1> >(src, num).template cast<S>();
+  }
+
+  //! Converts num coefficients of EigScalarType scalar_type at src into dst.
+  template<class S>
+  void convertScalars(const char* src, int scalar_type, uint64_t num, S* dst)
+  {
+    switch(scalar_type) {
+    case EIG_INT8: convertScalars((const int8_t*)src, num, dst); break;
+    case EIG_UINT8: convertScalars((const uint8_t*)src, num, dst); break;
+    case EIG_INT16: convertScalars((const int16_t*)src, num, dst); break;
+    case EIG_UINT16: convertScalars((const uint16_t*)src, num, dst); break;
+    case EIG_INT32: convertScalars((const int32_t*)src, num, dst); break;
+    case EIG_UINT32: convertScalars((const uint32_t*)src, num, dst); break;
+    case EIG_INT64: convertScalars((const int64_t*)src, num, dst); break;
+    case EIG_UINT64: convertScalars((const uint64_t*)src, num, dst); break;
+    case EIG_FLOAT32: convertScalars((const float*)src, num, dst); break;
+    case EIG_FLOAT64: convertScalars((const double*)src, num, dst); break;
+    default:
+      std::cerr << "Cannot convert from unknown scalar type " << scalar_type << "." << std::endl;
+      abort();
+    }
+  }
+
+  //! Reads num coefficients into dst, converting CONVERSION_CHUNK_SIZE bytes at a time.
+  template<class S>
+  void readConverted(std::istream& strm, const EigHeader& header, uint64_t num, S* dst)
+  {
+    uint64_t chunk = std::max<uint64_t>(1, CONVERSION_CHUNK_SIZE / header.bytes);
+    std::vector<char> buf(std::min(chunk, num) * header.bytes);
+    for(uint64_t i = 0; i < num; i += chunk) {
+      uint64_t n = std::min(chunk, num - i);
+      strm.read(&buf[0], n * header.bytes);
+      convertScalars(&buf[0], header.scalar_type, n, dst + i);
+    }
+  }
+  
+  //! Encodes num coefficients from src into header.vectorSize() bytes at dst.
+  template<class S>
+  void encodeVector(const S* src, int64_t num, const EigHeader& header, char* dst)
+  {
+    float scale = 0;
+    float offset = 0;
+    if(header.encoding == EIG_AFFINE_INT8) {
+      Eigen::Map<const Eigen::Matrix<S, Eigen::Dynamic, 1> > vec(src, num);
+      if(num > 0)
+        affineParams(vec.minCoeff(), vec.maxCoeff(), &scale, &offset);
+      memcpy(dst, &scale, sizeof(float));
+      memcpy(dst + sizeof(float), &offset, sizeof(float));
+      dst += EIG_AFFINE_PARAMS_SIZE;
+    }
+
+    float buf[ENCODING_CHUNK_SIZE];
+    for(int64_t i = 0; i < num; i += ENCODING_CHUNK_SIZE) {
+      int64_t chunk = std::min<int64_t>(ENCODING_CHUNK_SIZE, num - i);
+      for(int64_t j = 0; j < chunk; ++j)
+        buf[j] = src[i + j];
+      char* out = dst + i * header.bytes;
+      switch(header.encoding) {
+      case EIG_FLOAT16: encodeFloat16(buf, chunk, (uint16_t*)out); break;
+      case EIG_BFLOAT16: encodeBfloat16(buf, chunk, (uint16_t*)out); break;
+      case EIG_AFFINE_INT8: encodeAffineInt8(buf, chunk, scale, offset, (uint8_t*)out); break;
+      default: assert(0);
+      }
+    }
+  }
+
+  //! Decodes one float chunk.  Returns dst if it could decode in place, buf otherwise.
+  inline const float* decodeChunk(const char* src, int64_t num, const EigHeader& header,
+                                  float scale, float offset, float* dst, float* buf)
+  {
+    float* out = dst ? dst : buf;
+    switch(header.encoding) {
+    case EIG_FLOAT16: decodeFloat16((const uint16_t*)src, num, out); break;
+    case EIG_BFLOAT16: decodeBfloat16((const uint16_t*)src, num, out); break;
+    case EIG_AFFINE_INT8: decodeAffineInt8((const uint8_t*)src, num, scale, offset, out); break;
+    default: assert(0);
+    }
+    return out;
+  }
+
+  //! Float destinations are decoded in place.
+  inline float* decodeDestination(float* dst) { return dst; }
+  template<class S> float* decodeDestination(S*) { return NULL; }
+  
+  //! Inverse of encodeVector().  Also converts unencoded vectors to S
+  //! and undoes the byte shuffle.
+  template<class S>
+  void decodeVector(const char* src, int64_t num, const EigHeader& header, S* dst)
+  {
+    bool shuffled = header.flags & EIG_SHUFFLED;
+    if(header.encoding == EIG_RAW && !shuffled) {
+      convertScalars(src, header.scalar_type, num, dst);
+      return;
+    }
+    if(header.encoding == EIG_RAW && header.bytes == sizeof(S) &&
+       header.scalar_type == EigScalarTraits<S>::type) {
+      unshuffleBytes(src, num, header.bytes, (char*)dst);
+      return;
+    }
+    
+    float scale = 0;
+    float offset = 0;
+    if(header.encoding == EIG_AFFINE_INT8) {
+      memcpy(&scale, src, sizeof(float));
+      memcpy(&offset, src + sizeof(float), sizeof(float));
+      src += EIG_AFFINE_PARAMS_SIZE;
+    }
+
+    float buf[ENCODING_CHUNK_SIZE];
+    char unshuffled[ENCODING_CHUNK_SIZE * sizeof(double)];
+    for(int64_t i = 0; i < num; i += ENCODING_CHUNK_SIZE) {
+      int64_t chunk = std::min<int64_t>(ENCODING_CHUNK_SIZE, num - i);
+      const char* in = src + i * header.bytes;
+      if(shuffled) {
+        unshuffleBytes(src + i, num, chunk, header.bytes, unshuffled);
+        in = unshuffled;
+      }
+      if(header.encoding == EIG_RAW) {
+        convertScalars(in, header.scalar_type, chunk, dst + i);
+        continue;
+      }
+      const float* out = decodeChunk(in, chunk, header, scale, offset,
+                                     decodeDestination(dst + i), buf);
+      if(out == buf)
+        for(int64_t j = 0; j < chunk; ++j)
+          dst[i + j] = buf[j];
+    }
+  }
+
+  //! Decodes a whole encoded payload held in memory.
+  template<class S, int T, int U, int O>
+  void decodePayload(const char* src, const EigHeader& header, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    int64_t inner = header.innerSize();
+    for(int64_t i = 0; i < header.outerSize(); ++i)
+      decodeVector(src + i * header.vectorSize(), inner, header, mat->data() + i * inner);
+  }
+  
+  //! Header describing mat before any encoding is applied.
+  template<class S, int T, int U, int O>
+  EigHeader makeHeader(const Eigen::Matrix<S, T, U, O>& mat, const SaveOptions& opts)
+  {
+    EigHeader header;
+    header.bytes = sizeof(S);
+    header.scalar_type = EigScalarTraits<S>::type;
+    header.rows = mat.rows();
+    header.cols = mat.cols();
+    if(mat.IsRowMajor)
+      header.flags |= EIG_ROW_MAJOR;
+    if(opts.shuffle)
+      header.flags |= EIG_SHUFFLED;
+    return header;
+  }
+  
+  template<class S, int T, int U, int O>
+  void serialize(const Eigen::Matrix<S, T, U, O>& mat, std::ostream& strm, const SaveOptions& opts)
+  {
+    EigHeader header = makeHeader(mat, opts);
+    if(opts.encoding == EIG_RAW && !opts.shuffle) {
+      serializeHeader(header, strm);
+      strm.write((const char*)mat.data(), header.payloadSize());
+      return;
+    }
+
+    // -- Encode and shuffle one stored vector at a time.
+    if(opts.encoding != EIG_RAW) {
+      assert(header.scalar_type == EIG_FLOAT32 || header.scalar_type == EIG_FLOAT64);
+      header.encoding = opts.encoding;
+      header.bytes = encodedBytes(opts.encoding);
+      assert(header.bytes > 0);
+    }
+    serializeHeader(header, strm);
+    int64_t inner = header.innerSize();
+    // Encoding parameters precede the values and are not shuffled.
+    uint64_t params = header.vectorSize() - header.bytes * inner;
+    std::vector<char> encoded(opts.encoding == EIG_RAW ? 0 : header.vectorSize());
+    std::vector<char> shuffled(opts.shuffle ? header.vectorSize() : 0);
+    for(int64_t i = 0; i < header.outerSize(); ++i) {
+      const char* ptr = (const char*)(mat.data() + i * inner);
+      if(!encoded.empty()) {
+        encodeVector(mat.data() + i * inner, inner, header, &encoded[0]);
+        ptr = &encoded[0];
+      }
+      if(!shuffled.empty()) {
+        memcpy(&shuffled[0], ptr, params);
+        shuffleBytes(ptr + params, inner, header.bytes, &shuffled[params]);
+        ptr = &shuffled[0];
+      }
+      strm.write(ptr, header.vectorSize());
+    }
+  }
+  
+  template<class S, int T, int U, int O>
+  void deserialize(std::istream& strm, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    EigHeader header;
+    deserializeHeader(strm, &header);
+    checkHeader(header, *mat);
+
+    // resize() is a no-op if mat already has this shape, so repeated
+    // loads of same-shaped matrices do not touch the heap.
+    mat->resize(header.rows, header.cols);
+    if(needsTranspose(header, *mat)) {
+      readTransposed(strm, header, mat->data());
+      return;
+    }
+    if(isDirectlyReadable<S>(header)) {
+      strm.read((char*)mat->data(), header.payloadSize());
+      return;
+    }
+    if(header.encoding == EIG_RAW && !(header.flags & EIG_SHUFFLED)) {
+      readConverted(strm, header, mat->size(), mat->data());
+      return;
+    }
+
+    int64_t inner = header.innerSize();
+    std::vector<char> buf(header.vectorSize());
+    char* ptr = buf.empty() ? NULL : &buf[0];
+    for(int64_t i = 0; i < header.outerSize(); ++i) {
+      strm.read(ptr, buf.size());
+      decodeVector(ptr, inner, header, mat->data() + i * inner);
+    }
+  }
+
+  template<class S, int T, int U, int O>
+  void serializeFixed(const Eigen::Matrix<S, T, U, O>& mat, std::ostream& strm)
+  {
+    BOOST_STATIC_ASSERT(T != Eigen::Dynamic && U != Eigen::Dynamic);
+    strm.write((const char*)mat.data(), sizeof(S) * T * U);
+  }
+
+  template<class S, int T, int U, int O>
+  void deserializeFixed(std::istream& strm, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    BOOST_STATIC_ASSERT(T != Eigen::Dynamic && U != Eigen::Dynamic);
+    strm.read((char*)mat->data(), sizeof(S) * T * U);
+  }
+
+  template<class S, int T, int U, int O, class Allocator>
+  void serialize(const std::vector<Eigen::Matrix<S, T, U, O>, Allocator>& vec, std::ostream& strm)
+  {
+    typedef Eigen::Matrix<S, T, U, O> MatrixType;
+    BOOST_STATIC_ASSERT(T != Eigen::Dynamic && U != Eigen::Dynamic);
+    // Elements must be contiguous coefficients with no padding between them.
+    BOOST_STATIC_ASSERT(sizeof(MatrixType) == sizeof(S) * T * U);
+    uint64_t num = vec.size();
+    int32_t bytes = sizeof(MatrixType);
+    strm.write((const char*)&num, sizeof(num));
+    strm.write((const char*)&bytes, sizeof(bytes));
+    if(num > 0)
+      strm.write((const char*)vec[0].data(), num * sizeof(MatrixType));
+  }
+
+  template<class S, int T, int U, int O, class Allocator>
+  void deserialize(std::istream& strm, std::vector<Eigen::Matrix<S, T, U, O>, Allocator>* vec)
+  {
+    typedef Eigen::Matrix<S, T, U, O> MatrixType;
+    BOOST_STATIC_ASSERT(T != Eigen::Dynamic && U != Eigen::Dynamic);
+    BOOST_STATIC_ASSERT(sizeof(MatrixType) == sizeof(S) * T * U);
+    uint64_t num;
+    int32_t bytes;
+    strm.read((char*)&num, sizeof(num));
+    strm.read((char*)&bytes, sizeof(bytes));
+    vec->clear();
+    if(!strm)
+      return;
+    if(bytes != sizeof(MatrixType)) {
+      std::cerr << "Cannot read " << bytes << "-byte elements into a vector of "
+                << sizeof(MatrixType) << "-byte matrices." << std::endl;
+      strm.setstate(std::ios::failbit);
+      return;
+    }
+    
+    // -- num is untrusted, so grow only as data actually arrives.
+    uint64_t chunk = std::max<uint64_t>(1, CONVERSION_CHUNK_SIZE / sizeof(MatrixType));
+    for(uint64_t i = 0; i < num; i += chunk) {
+      uint64_t n = std::min(chunk, num - i);
+      vec->resize(i + n);
+      strm.read((char*)(*vec)[i].data(), n * sizeof(MatrixType));
+      if(!strm) {
+        std::cerr << "Stream ended after " << i << " of " << num << " matrices." << std::endl;
+        vec->clear();
+        return;
+      }
+    }
+  }
+  
+  //! load() reads .gz files as gzip, so a codec stream must not be given that name.
+  inline bool checkCodecFilename(const std::string& filename, const SaveOptions& opts)
+  {
+    if(opts.codec != EIG_CODEC_NONE && filename.substr(filename.size() - 3, 3).compare(".gz") == 0) {
+      std::cerr << "Cannot save " << filename << " with codec " << opts.codec
+                << ": load() would read it as gzip.  Use .eig, .eig.lz4 or .eig.zst." << std::endl;
+      return false;
+    }
+    return true;
   }
 
-  template<class S, int T, int U>
-  void save(const Eigen::Matrix<S, T, U>& mat, const std::string& filename)
+  template<class S, int T, int U, int O>
+  bool save(const Eigen::Matrix<S, T, U, O>& mat, const std::string& filename, const SaveOptions& opts)
   {
     assert(filename.size() > 3);
-    if(filename.substr(filename.size() - 3, 3).compare(".gz") == 0) {
-      ogzstream file(filename.c_str());
-      assert(file);
-      serialize(mat, file);
+    int codec = opts.codec ? opts.codec : codecForFilename(filename);
+    if(!checkCodecFilename(filename, opts))
+      return false;
+    if(codec != EIG_CODEC_NONE) {
+      CodecOstream file(filename, codec, opts.level, opts.num_threads);
+      if(!file) {
+        std::cerr << "Could not open " << filename << " for writing." << std::endl;
+        return false;
+      }
+      serialize(mat, file, opts);
       file.close();
+      if(file.fail()) {
+        std::cerr << "Write to " << filename << " failed." << std::endl;
+        return false;
+      }
     }
-    else { 
+    else if(filename.substr(filename.size() - 3, 3).compare(".gz") == 0) {
+      ParallelGzipOstream file(filename, opts.num_threads, opts.level, opts.blocked_gzip);
+      if(!file) {
+        std::cerr << "Could not open " << filename << " for writing." << std::endl;
+        return false;
+      }
+      serialize(mat, file, opts);
+      file.close();
+      if(file.fail()) {
+        std::cerr << "Write to " << filename << " failed." << std::endl;
+        return false;
+      }
+    }
+    else if(opts.encoding == EIG_RAW && !opts.shuffle) {
+      // -- Header and payload go to the kernel in one writev.
+      assert(boost::filesystem::extension(filename).compare(".eig") == 0);
+      EigHeader header = makeHeader(mat, opts);
+      struct iovec iov[2];
+      iov[0].iov_base = &header;
+      iov[0].iov_len = sizeof(header);
+      iov[1].iov_base = (void*)mat.data();
+      iov[1].iov_len = header.payloadSize();
+      if(!writeFile(filename, iov, 2, opts.direct_io, opts.preallocate))
+        return false;
+    }
+    else {
       assert(boost::filesystem::extension(filename).compare(".eig") == 0);
       std::ofstream file(filename.c_str());
-      assert(file);
-      serialize(mat, file);
+      if(!file) {
+        std::cerr << "Could not open " << filename << " for writing." << std::endl;
+        return false;
+      }
+      serialize(mat, file, opts);
       file.close();
+      if(file.fail()) {
+        std::cerr << "Write to " << filename << " failed." << std::endl;
+        return false;
+      }
     }
+    return true;
   }
 
-  template<class S, int T, int U>
-  void load(const std::string& filename, Eigen::Matrix<S, T, U>* mat)
+  template<class S, int T, int U, int O>
+  void load(const std::string& filename, Eigen::Matrix<S, T, U, O>* mat)
   {
     assert(filename.size() > 3);
     if(filename.substr(filename.size() - 3, 3).compare(".gz") == 0) {
+      if(isBlockedGzip(filename)) {
+        BlockedGzipReader reader(filename);
+        deserialize(reader, mat);
+        return;
+      }
       igzstream file(filename.c_str());
       assert(file);
       deserialize(file, mat);
       file.close();
     }
+    else if(isCodecFile(filename)) {
+      CodecIstream file(filename);
+      assert(file);
+      deserialize(file, mat);
+      file.close();
+    }
     else {
       assert(boost::filesystem::extension(filename).compare(".eig") == 0);
       std::ifstream file(filename.c_str());
@@ -134,58 +944,423 @@ namespace eigen_extensions {
     }
   }
 
-  template<class ScalarType, int Options, class IndexType>
-  void serialize(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, std::ostream& strm)
-  {
-    int bytes = sizeof(ScalarType);
-    int type = Options;
-    int outer = mat.outerSize();
-    int inner = mat.innerSize();
-    int nnz = mat.nonZeros();
-    strm.write((char*)&bytes, sizeof(int));
-    strm.write((char*)&type, sizeof(int));
-    strm.write((char*)&outer, sizeof(int));
-    strm.write((char*)&inner, sizeof(int));
-    strm.write((char*)&nnz, sizeof(int));
+  //! Reads the header from the first bytes of a blocked gzip file.
+  //! Returns false if the file is too short to hold one.
+  inline bool deserializeHeader(const BlockedGzipReader& reader, EigHeader* header)
+  {
+    char buf[EIG_HEADER_SIZE];
+    uint64_t num = std::min<uint64_t>(sizeof(buf), reader.size());
+    reader.read(0, num, buf, 1);
+    return parseHeader(buf, num, header);
+  }
+  
+  template<class S, int T, int U, int O>
+  void deserialize(const BlockedGzipReader& reader, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    EigHeader header;
+    if(!deserializeHeader(reader, &header) || header.dataOffset() + header.payloadSize() > reader.size()) {
+      std::cerr << "Blocked gzip file is too short for its .eig header." << std::endl;
+      abort();
+    }
+    checkHeader(header, *mat);
     
-    typedef typename Eigen::SparseMatrix<ScalarType, Options, IndexType>::InnerIterator InnerIterator;
-    for(IndexType i = 0; i < mat.outerSize(); ++i) {
-      int num = 0;
-      for(InnerIterator it(mat, i); it; ++it)
-	++num;
-      strm.write((const char*)&num, sizeof(num));
-      
-      for(InnerIterator it(mat, i); it; ++it) {
-	int idx = it.index();
-	ScalarType buf = it.value();
-	strm.write((const char*)&idx, sizeof(idx));
-	strm.write((const char*)&buf, sizeof(buf));
+    mat->resize(header.rows, header.cols);
+    if(needsTranspose(header, *mat)) {
+      readTransposed(reader, header, mat->data());
+      return;
+    }
+    if(isDirectlyReadable<S>(header)) {
+      reader.read(header.dataOffset(), header.payloadSize(), (char*)mat->data());
+      return;
+    }
+    if(header.encoding == EIG_RAW && !(header.flags & EIG_SHUFFLED)) {
+      uint64_t chunk = std::max<uint64_t>(1, CONVERSION_CHUNK_SIZE / header.bytes);
+      uint64_t num = mat->size();
+      std::vector<char> buf(std::min(chunk, num) * header.bytes);
+      for(uint64_t i = 0; i < num; i += chunk) {
+        uint64_t n = std::min(chunk, num - i);
+        reader.read(header.dataOffset() + i * header.bytes, n * header.bytes, &buf[0]);
+        convertScalars(&buf[0], header.scalar_type, n, mat->data() + i);
       }
+      return;
+    }
+
+    std::vector<char> buf(header.payloadSize());
+    reader.read(header.dataOffset(), buf.size(), buf.empty() ? NULL : &buf[0]);
+    decodePayload(buf.empty() ? NULL : &buf[0], header, mat);
+  }
+
+  //! Reads num stored vectors from the current position of strm into dst.
+  template<class S>
+  void readVectors(std::istream& strm, const EigHeader& header, int64_t num, S* dst)
+  {
+    if(isDirectlyReadable<S>(header)) {
+      strm.read((char*)dst, num * header.vectorSize());
+      return;
+    }
+    
+    std::vector<char> buf(header.vectorSize());
+    char* ptr = buf.empty() ? NULL : &buf[0];
+    for(int64_t i = 0; i < num; ++i) {
+      strm.read(ptr, buf.size());
+      decodeVector(ptr, header.innerSize(), header, dst + i * header.innerSize());
     }
   }
 
+  //! Reads num stored vectors starting with vector first into dst.
+  template<class S>
+  void readVectors(const BlockedGzipReader& reader, const EigHeader& header, int64_t first, int64_t num, S* dst)
+  {
+    uint64_t offset = header.dataOffset() + first * header.vectorSize();
+    if(isDirectlyReadable<S>(header)) {
+      reader.read(offset, num * header.vectorSize(), (char*)dst);
+      return;
+    }
+
+    std::vector<char> buf(num * header.vectorSize());
+    char* ptr = buf.empty() ? NULL : &buf[0];
+    reader.read(offset, buf.size(), ptr);
+    for(int64_t i = 0; i < num; ++i)
+      decodeVector(ptr + i * header.vectorSize(), header.innerSize(), header, dst + i * header.innerSize());
+  }
+
+  //! Number of coefficients on a side of the tiles transposeVectorRange() works on.
+  const int TRANSPOSE_TILE_SIZE = 32;
+  
+  //! Sets dst[k * dst_stride + v] = src[v * inner + k] for v in [0, num) and
+  //! k in [begin, end), tile by tile so that reads and writes both stay in cache.
+  template<class S>
+  void transposeVectorRange(const S* src, int64_t num, int64_t inner, int64_t begin, int64_t end,
+                            int64_t dst_stride, S* dst)
+  {
+    for(int64_t k0 = begin; k0 < end; k0 += TRANSPOSE_TILE_SIZE) {
+      int64_t k1 = std::min<int64_t>(k0 + TRANSPOSE_TILE_SIZE, end);
+      for(int64_t v0 = 0; v0 < num; v0 += TRANSPOSE_TILE_SIZE) {
+        int64_t v1 = std::min<int64_t>(v0 + TRANSPOSE_TILE_SIZE, num);
+        for(int64_t k = k0; k < k1; ++k)
+          for(int64_t v = v0; v < v1; ++v)
+            dst[k * dst_stride + v] = src[v * inner + k];
+      }
+    }
+  }
+
+  //! Splits transposeVectorRange() over all cores when there is enough work.
+  template<class S>
+  void transposeVectors(const S* src, int64_t num, int64_t inner, int64_t dst_stride, S* dst)
+  {
+    int num_threads = std::max<int>(1, boost::thread::hardware_concurrency());
+    if(num * inner < (1 << 16))
+      num_threads = 1;
+    num_threads = std::min<int64_t>(num_threads, inner);
+    if(num_threads <= 1) {
+      transposeVectorRange(src, num, inner, 0, inner, dst_stride, dst);
+      return;
+    }
+    
+    boost::thread_group threads;
+    for(int i = 0; i < num_threads; ++i) {
+      int64_t begin = inner * i / num_threads;
+      int64_t end = inner * (i + 1) / num_threads;
+      threads.create_thread(boost::bind(&transposeVectorRange<S>, src, num, inner, begin, end, dst_stride, dst));
+    }
+    threads.join_all();
+  }
+  
+  inline void readPanel(std::istream& strm, const EigHeader&, int64_t, int64_t, char* dst, uint64_t len)
+  {
+    strm.read(dst, len);
+  }
+
+  inline void readPanel(const BlockedGzipReader& reader, const EigHeader& header, int64_t first, int64_t, char* dst, uint64_t len)
+  {
+    reader.read(header.dataOffset() + first * header.vectorSize(), len, dst);
+  }
+  
+  //! Reads a payload stored in the other storage order into dst, converting
+  //! and transposing it a panel of stored vectors at a time.
+  template<class Source, class S>
+  void readTransposed(Source& src, const EigHeader& header, S* dst)
+  {
+    int64_t outer = header.outerSize();
+    int64_t inner = header.innerSize();
+    int64_t panel = std::max<int64_t>(1, CONVERSION_CHUNK_SIZE / (sizeof(S) * inner));
+    panel = std::min(panel, outer);
+    std::vector<S> buf(panel * inner);
+    std::vector<char> raw(isDirectlyReadable<S>(header) ? 0 : panel * header.vectorSize());
+    for(int64_t i = 0; i < outer; i += panel) {
+      int64_t num = std::min(panel, outer - i);
+      if(raw.empty())
+        readPanel(src, header, i, num, (char*)&buf[0], num * header.vectorSize());
+      else {
+        readPanel(src, header, i, num, &raw[0], num * header.vectorSize());
+        for(int64_t j = 0; j < num; ++j)
+          decodeVector(&raw[j * header.vectorSize()], inner, header, &buf[j * inner]);
+      }
+      transposeVectors(&buf[0], num, inner, outer, dst + i);
+    }
+  }
+  
+  //! Checks that columns can be read from a file with this header.
+  inline void checkColumnAccess(EigHeader* header, const std::vector<int64_t>& indices)
+  {
+    // -- A row vector is laid out the same either way.
+    if(header->rowMajor() && header->rows == 1 && header->encoding == EIG_RAW && !(header->flags & EIG_SHUFFLED))
+      header->flags &= ~EIG_ROW_MAJOR;
+    if(header->rowMajor()) {
+      std::cerr << "loadCols() requires a column-major file." << std::endl;
+      assert(0);
+    }
+    for(size_t i = 0; i < indices.size(); ++i)
+      assert(indices[i] >= 0 && indices[i] < header->cols);
+  }
+  
+  //! loadCols() for streams that cannot seek.  Reads through strm in
+  //! column order, skipping what we don't need.  mat must be column-major.
+  template<class S, int T, int U, int O>
+  void loadColsSequential(std::istream& strm, const std::vector<int64_t>& indices, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    EigHeader header;
+    deserializeHeader(strm, &header);
+    checkHeader(header, *mat);
+    checkColumnAccess(&header, indices);
+    mat->resize(header.rows, indices.size());
+    int64_t rows = header.rows;
+    
+    std::vector< std::pair<int64_t, int64_t> > order(indices.size());
+    for(size_t i = 0; i < indices.size(); ++i)
+      order[i] = std::make_pair(indices[i], (int64_t)i);
+    std::sort(order.begin(), order.end());
+
+    std::vector<char> scratch(1 << 16);
+    int64_t position = 0;
+    for(size_t i = 0; i < order.size(); ++i) {
+      if(i > 0 && order[i].first == order[i - 1].first) {
+        mat->col(order[i].second) = mat->col(order[i - 1].second);
+        continue;
+      }
+      uint64_t skip = (order[i].first - position) * header.vectorSize();
+      while(skip > 0) {
+        uint64_t num = std::min<uint64_t>(skip, scratch.size());
+        strm.read(&scratch[0], num);
+        skip -= num;
+      }
+      readVectors(strm, header, 1, mat->data() + order[i].second * rows);
+      position = order[i].first + 1;
+    }
+    assert(strm);
+  }
+  
+  template<class S, int T, int U, int O>
+  void loadCols(const std::string& filename, int64_t begin, int64_t end, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    assert(begin >= 0 && begin <= end);
+    std::vector<int64_t> indices(end - begin);
+    for(int64_t i = begin; i < end; ++i)
+      indices[i - begin] = i;
+    loadCols(filename, indices, mat);
+  }
+
+  template<class S, int T, int U, int O>
+  void loadCols(const std::string& filename, const std::vector<int64_t>& indices, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    // -- Columns are gathered in column-major order.
+    if(mat->IsRowMajor) {
+      Eigen::Matrix<S, Eigen::Dynamic, Eigen::Dynamic> tmp;
+      loadCols(filename, indices, &tmp);
+      *mat = tmp;
+      return;
+    }
+    
+    assert(filename.size() > 3);
+    bool gz = (filename.substr(filename.size() - 3, 3).compare(".gz") == 0);
+    
+    // -- Plain gzip and codec files cannot seek, so stream through the file.
+    if(gz && !isBlockedGzip(filename)) {
+      igzstream file(filename.c_str());
+      assert(file);
+      loadColsSequential(file, indices, mat);
+      file.close();
+      return;
+    }
+    if(!gz && isCodecFile(filename)) {
+      CodecIstream file(filename);
+      assert(file);
+      loadColsSequential(file, indices, mat);
+      file.close();
+      return;
+    }
+
+    // -- Seekable files.  Runs of consecutive indices are read together.
+    boost::scoped_ptr<BlockedGzipReader> reader;
+    std::ifstream file;
+    EigHeader header;
+    if(gz) {
+      reader.reset(new BlockedGzipReader(filename));
+      if(!deserializeHeader(*reader, &header)) {
+        std::cerr << filename << " is too short for a .eig header." << std::endl;
+        abort();
+      }
+    }
+    else {
+      assert(boost::filesystem::extension(filename).compare(".eig") == 0);
+      file.open(filename.c_str());
+      assert(file);
+      deserializeHeader(file, &header);
+    }
+    checkHeader(header, *mat);
+    checkColumnAccess(&header, indices);
+    mat->resize(header.rows, indices.size());
+    
+    int64_t rows = header.rows;
+    size_t i = 0;
+    while(i < indices.size()) {
+      size_t j = i + 1;
+      while(j < indices.size() && indices[j] == indices[j - 1] + 1)
+        ++j;
+      if(reader)
+        readVectors(*reader, header, indices[i], j - i, mat->data() + i * rows);
+      else {
+        file.seekg(header.dataOffset() + indices[i] * header.vectorSize());
+        readVectors(file, header, j - i, mat->data() + i * rows);
+        assert(file);
+      }
+      i = j;
+    }
+  }
+
+  //! Writes the body of a packed sparse matrix: the byte length of the index
+  //! stream, then for each outer vector a varint count followed by varint
+  //! gaps between successive inner indices, then the values.
   template<class ScalarType, int Options, class IndexType>
-  void deserialize(std::istream& strm, Eigen::SparseMatrix<ScalarType, Options, IndexType>* mat)
+  void serializePacked(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat,
+                       const EigSparseHeader& header, std::ostream& strm)
   {
-    int bytes;
-    int options;
-    int outer;
-    int inner;
-    int nnz;
-    strm.read((char*)&bytes, sizeof(int));
-    strm.read((char*)&options, sizeof(int));
-    strm.read((char*)&outer, sizeof(int));
-    strm.read((char*)&inner, sizeof(int));
-    strm.read((char*)&nnz, sizeof(int));
-    assert(bytes == sizeof(ScalarType));
-    assert(options == Options);
+    std::string indices;
+    indices.reserve(header.outer + header.nnz + VARINT_OVERREAD);
+    for(int64_t i = 0; i < header.outer; ++i) {
+      int64_t begin = mat.outerIndexPtr()[i];
+      int64_t end = mat.outerIndexPtr()[i + 1];
+      encodeVarint(end - begin, &indices);
+      int64_t prev = -1;
+      for(int64_t j = begin; j < end; ++j) {
+        encodeVarint(mat.innerIndexPtr()[j] - prev - 1, &indices);
+        prev = mat.innerIndexPtr()[j];
+      }
+    }
+    // Padding lets the decoder read a word at a time.
+    indices.append(VARINT_OVERREAD, '\0');
+    
+    uint64_t num = indices.size();
+    strm.write((const char*)&num, sizeof(num));
+    strm.write(indices.data(), indices.size());
+  }
 
-    if(mat->IsRowMajor) 
-      mat->resize(outer, inner);
-    else
-      mat->resize(inner, outer);
+  //! Writes values, byte-shuffled if the header says so.
+  template<class ScalarType>
+  void serializeValues(const ScalarType* values, const EigSparseHeader& header, std::ostream& strm)
+  {
+    uint64_t num = (uint64_t)header.bytes * header.nnz;
+    if(!(header.flags & EIG_SHUFFLED)) {
+      strm.write((const char*)values, num);
+      return;
+    }
 
-    mat->reserve(nnz);
+    std::vector<char> buf(num);
+    shuffleBytes((const char*)values, header.nnz, header.bytes, buf.empty() ? NULL : &buf[0]);
+    strm.write(buf.empty() ? NULL : &buf[0], num);
+  }
+
+  template<class ScalarType>
+  void deserializeValues(std::istream& strm, const EigSparseHeader& header, ScalarType* values)
+  {
+    uint64_t num = (uint64_t)header.bytes * header.nnz;
+    if(!(header.flags & EIG_SHUFFLED)) {
+      strm.read((char*)values, num);
+      return;
+    }
+
+    std::vector<char> buf(num);
+    strm.read(buf.empty() ? NULL : &buf[0], num);
+    unshuffleBytes(buf.empty() ? NULL : &buf[0], header.nnz, header.bytes, (char*)values);
+  }
+  
+  template<class ScalarType, int Options, class IndexType>
+  EigSparseHeader makeHeader(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, const SaveOptions& opts)
+  {
+    typedef Eigen::SparseMatrix<ScalarType, Options, IndexType> SparseType;
+    EigSparseHeader header;
+    header.bytes = sizeof(ScalarType);
+    header.scalar_type = EigScalarTraits<ScalarType>::type;
+    header.index_bytes = sizeof(typename SparseType::StorageIndex);
+    header.flags = mat.IsRowMajor ? EIG_ROW_MAJOR : 0;
+    if(opts.packed_indices)
+      header.flags |= EIG_PACKED_INDICES;
+    if(opts.shuffle)
+      header.flags |= EIG_SHUFFLED;
+    header.outer = mat.outerSize();
+    header.inner = mat.innerSize();
+    header.nnz = mat.nonZeros();
+    return header;
+  }
+  
+  template<class ScalarType, int Options, class IndexType>
+  void serialize(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, std::ostream& strm,
+                 const SaveOptions& opts)
+  {
+    typedef Eigen::SparseMatrix<ScalarType, Options, IndexType> SparseType;
+    // Uncompressed matrices have gaps between outer vectors.
+    if(!mat.isCompressed()) {
+      SparseType compressed = mat;
+      compressed.makeCompressed();
+      serialize(compressed, strm, opts);
+      return;
+    }
+
+    EigSparseHeader header = makeHeader(mat, opts);
+    serializeHeader(header, strm);
+
+    if(opts.packed_indices) {
+      serializePacked(mat, header, strm);
+      serializeValues(mat.valuePtr(), header, strm);
+      return;
+    }
+
+    const char zeros[EIG_ALIGNMENT] = {0};
+    uint64_t num = (uint64_t)header.index_bytes * (header.outer + 1);
+    strm.write((const char*)mat.outerIndexPtr(), num);
+    strm.write(zeros, header.innerIndexOffset() - header.outerIndexOffset() - num);
+    num = (uint64_t)header.index_bytes * header.nnz;
+    strm.write((const char*)mat.innerIndexPtr(), num);
+    strm.write(zeros, header.valueOffset() - header.innerIndexOffset() - num);
+    serializeValues(mat.valuePtr(), header, strm);
+  }
+
+  //! Reads num indices stored with index_bytes bytes each into dest.
+  template<class IndexType>
+  void deserializeIndices(std::istream& strm, int index_bytes, uint64_t num, IndexType* dest)
+  {
+    if(index_bytes == sizeof(IndexType)) {
+      strm.read((char*)dest, sizeof(IndexType) * num);
+      return;
+    }
+
+    assert(index_bytes == sizeof(int32_t) || index_bytes == sizeof(int64_t));
+    std::vector<char> buf(index_bytes * num);
+    strm.read(&buf[0], buf.size());
+    for(uint64_t i = 0; i < num; ++i) {
+      if(index_bytes == sizeof(int32_t))
+        dest[i] = ((const int32_t*)&buf[0])[i];
+      else
+        dest[i] = ((const int64_t*)&buf[0])[i];
+    }
+  }
+
+  //! Reads the body of a version 1 sparse file, one element at a time.
+  template<class ScalarType, int Options, class IndexType>
+  void deserializeVersion1(std::istream& strm, const EigSparseHeader& header,
+                           Eigen::SparseMatrix<ScalarType, Options, IndexType>* mat)
+  {
+    mat->reserve(header.nnz);
     ScalarType buf;
     for(int i = 0; i < mat->outerSize(); ++i) {
       mat->startVec(i);
@@ -200,64 +1375,475 @@ namespace eigen_extensions {
     }
     mat->finalize();
   }
+  
+  //! Reads the index stream written by serializePacked() into the outer and inner index arrays.
+  //! Returns false, without writing past either array, if the stream is truncated or corrupt.
+  template<class ScalarType, int Options, class IndexType>
+  bool deserializePacked(std::istream& strm, const EigSparseHeader& header,
+                         Eigen::SparseMatrix<ScalarType, Options, IndexType>* mat)
+  {
+    // -- Each varint is at most ten bytes.
+    uint64_t num;
+    strm.read((char*)&num, sizeof(num));
+    if(!strm || num < VARINT_OVERREAD || num > 10 * (uint64_t)(header.outer + header.nnz) + VARINT_OVERREAD)
+      return false;
+    std::vector<char> buf(num);
+    strm.read(&buf[0], num);
+    if(!strm)
+      return false;
 
+    // -- Every varint must end inside the stream, and there must be exactly
+    //    one per outer vector and one per nonzero, so that decoding cannot
+    //    run past the padding.  Bytes without the continuation bit end a varint.
+    const char* end = &buf[0] + num - VARINT_OVERREAD;
+    for(const char* pad = end; pad < end + VARINT_OVERREAD; ++pad)
+      if(*pad != 0)
+        return false;
+    uint64_t num_varints = 0;
+    for(const char* byte = &buf[0]; byte < end; ++byte)
+      num_varints += !(*byte & 0x80);
+    if(num_varints != (uint64_t)(header.outer + header.nnz) || (end > &buf[0] && (end[-1] & 0x80)))
+      return false;
+    
+    typedef typename Eigen::SparseMatrix<ScalarType, Options, IndexType>::StorageIndex StorageIndex;
+    StorageIndex* outer = mat->outerIndexPtr();
+    StorageIndex* inner = mat->innerIndexPtr();
+    const char* ptr = &buf[0];
+    outer[0] = 0;
+    for(int64_t i = 0; i < header.outer; ++i) {
+      uint64_t count;
+      ptr = decodeVarint(ptr, &count);
+      if(count > (uint64_t)(header.nnz - outer[i]) || count > (uint64_t)(end - ptr))
+        return false;
+      outer[i + 1] = outer[i] + count;
+      
+      // -- Decode the gaps in bulk, then prefix-sum them into indices.
+      StorageIndex* dest = inner + outer[i];
+      ptr = decodeVarints(ptr, count, dest);
+      int64_t prev = -1;
+      for(uint64_t j = 0; j < count; ++j) {
+        prev += dest[j] + 1;
+        if((uint64_t)prev >= (uint64_t)header.inner)
+          return false;
+        dest[j] = prev;
+      }
+    }
+    return outer[header.outer] == header.nnz && ptr == end;
+  }
+  
   template<class ScalarType, int Options, class IndexType>
-  void save(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, const std::string& filename)
+  void deserialize(std::istream& strm, Eigen::SparseMatrix<ScalarType, Options, IndexType>* mat)
   {
-    assert(boost::filesystem::extension(filename).compare(".eig") == 0);
-    std::ofstream file(filename.c_str());
-    assert(file);
-    serialize(mat, file);
-    file.close();
+    EigSparseHeader header;
+    deserializeHeader(strm, &header);
+    assert(header.bytes == sizeof(ScalarType));
+    assert(header.scalar_type == EIG_UNKNOWN_TYPE || header.scalar_type == EigScalarTraits<ScalarType>::type);
+    assert(header.rowMajor() == (bool)mat->IsRowMajor);
+
+    if(mat->IsRowMajor) 
+      mat->resize(header.outer, header.inner);
+    else
+      mat->resize(header.inner, header.outer);
+
+    if(header.version == 1) {
+      deserializeVersion1(strm, header, mat);
+      return;
+    }
+
+    mat->resizeNonZeros(header.nnz);
+    if(header.flags & EIG_PACKED_INDICES) {
+      if(!deserializePacked(strm, header, mat)) {
+        std::cerr << "Truncated or corrupt packed sparse indices." << std::endl;
+        abort();
+      }
+      deserializeValues(strm, header, mat->valuePtr());
+      return;
+    }
+    
+    // -- Read the compressed arrays straight into place.
+    char zeros[EIG_ALIGNMENT];
+    deserializeIndices(strm, header.index_bytes, header.outer + 1, mat->outerIndexPtr());
+    strm.read(zeros, header.innerIndexOffset() - header.outerIndexOffset() - header.index_bytes * (header.outer + 1));
+    deserializeIndices(strm, header.index_bytes, header.nnz, mat->innerIndexPtr());
+    strm.read(zeros, header.valueOffset() - header.innerIndexOffset() - header.index_bytes * header.nnz);
+    deserializeValues(strm, header, mat->valuePtr());
+  }
+
+  template<class ScalarType, int Options, class IndexType>
+  bool save(const Eigen::SparseMatrix<ScalarType, Options, IndexType>& mat, const std::string& filename,
+            const SaveOptions& opts)
+  {
+    assert(filename.size() > 3);
+    int codec = opts.codec ? opts.codec : codecForFilename(filename);
+    if(!checkCodecFilename(filename, opts))
+      return false;
+    if(codec != EIG_CODEC_NONE) {
+      CodecOstream file(filename, codec, opts.level, opts.num_threads);
+      if(!file) {
+        std::cerr << "Could not open " << filename << " for writing." << std::endl;
+        return false;
+      }
+      serialize(mat, file, opts);
+      file.close();
+      if(file.fail()) {
+        std::cerr << "Write to " << filename << " failed." << std::endl;
+        return false;
+      }
+    }
+    else if(filename.substr(filename.size() - 3, 3).compare(".gz") == 0) {
+      ParallelGzipOstream file(filename, opts.num_threads, opts.level, opts.blocked_gzip);
+      if(!file) {
+        std::cerr << "Could not open " << filename << " for writing." << std::endl;
+        return false;
+      }
+      serialize(mat, file, opts);
+      file.close();
+      if(file.fail()) {
+        std::cerr << "Write to " << filename << " failed." << std::endl;
+        return false;
+      }
+    }
+    else if(mat.isCompressed() && !opts.packed_indices && !opts.shuffle) {
+      // -- Header, arrays, and padding go to the kernel in one writev.
+      assert(boost::filesystem::extension(filename).compare(".eig") == 0);
+      EigSparseHeader header = makeHeader(mat, opts);
+      static const char zeros[EIG_ALIGNMENT] = {0};
+      struct iovec iov[6];
+      iov[0].iov_base = &header;
+      iov[0].iov_len = sizeof(header);
+      iov[1].iov_base = (void*)mat.outerIndexPtr();
+      iov[1].iov_len = (uint64_t)header.index_bytes * (header.outer + 1);
+      iov[2].iov_base = (void*)zeros;
+      iov[2].iov_len = header.innerIndexOffset() - header.outerIndexOffset() - iov[1].iov_len;
+      iov[3].iov_base = (void*)mat.innerIndexPtr();
+      iov[3].iov_len = (uint64_t)header.index_bytes * header.nnz;
+      iov[4].iov_base = (void*)zeros;
+      iov[4].iov_len = header.valueOffset() - header.innerIndexOffset() - iov[3].iov_len;
+      iov[5].iov_base = (void*)mat.valuePtr();
+      iov[5].iov_len = (uint64_t)header.bytes * header.nnz;
+      if(!writeFile(filename, iov, 6, opts.direct_io, opts.preallocate))
+        return false;
+    }
+    else {
+      assert(boost::filesystem::extension(filename).compare(".eig") == 0);
+      std::ofstream file(filename.c_str());
+      if(!file) {
+        std::cerr << "Could not open " << filename << " for writing." << std::endl;
+        return false;
+      }
+      serialize(mat, file, opts);
+      file.close();
+      if(file.fail()) {
+        std::cerr << "Write to " << filename << " failed." << std::endl;
+        return false;
+      }
+    }
+    return true;
   }
 
   template<class ScalarType, int Options, class IndexType>
   void load(const std::string& filename, Eigen::SparseMatrix<ScalarType, Options, IndexType>* mat)
   {
     assert(filename.size() > 3);
-    assert(boost::filesystem::extension(filename).compare(".eig") == 0);
-    std::ifstream file(filename.c_str());
-    assert(file);
-    deserialize(file, mat);
-    file.close();
+    if(filename.substr(filename.size() - 3, 3).compare(".gz") == 0) {
+      igzstream file(filename.c_str());
+      assert(file);
+      deserialize(file, mat);
+      file.close();
+    }
+    else if(isCodecFile(filename)) {
+      CodecIstream file(filename);
+      assert(file);
+      deserialize(file, mat);
+      file.close();
+    }
+    else {
+      assert(boost::filesystem::extension(filename).compare(".eig") == 0);
+      std::ifstream file(filename.c_str());
+      assert(file);
+      deserialize(file, mat);
+      file.close();
+    }
+  }
+  
+  // -- Tags for the kinds of scalar the ASCII conversions treat differently.
+  struct ASCIISignedTag {};
+  struct ASCIIUnsignedTag {};
+  struct ASCIIFloatingTag {};
+  struct ASCIIOtherTag {};
+  
+  template<class T>
+  struct ASCIIScalarTag
+  {
+    typedef typename boost::mpl::if_c<boost::is_floating_point<T>::value, ASCIIFloatingTag,
+      typename boost::mpl::if_c<boost::is_integral<T>::value,
+        typename boost::mpl::if_c<boost::is_signed<T>::value, ASCIISignedTag, ASCIIUnsignedTag>::type,
+        ASCIIOtherTag>::type>::type type;
+  };
+  
+  template<class T>
+  void parseASCIIScalar(const char* str, const char** end, T* val, ASCIISignedTag)
+  {
+    char* e;
+    *val = strtoll(str, &e, 10);
+    *end = e;
+  }
+
+  template<class T>
+  void parseASCIIScalar(const char* str, const char** end, T* val, ASCIIUnsignedTag)
+  {
+    char* e;
+    *val = strtoull(str, &e, 10);
+    *end = e;
+  }
+
+  template<class T>
+  void parseASCIIScalar(const char* str, const char** end, T* val, ASCIIFloatingTag)
+  {
+    char* e;
+    *val = strtod(str, &e);
+    *end = e;
+  }
+
+  template<class T>
+  void parseASCIIScalar(const char* str, const char** end, T* val, ASCIIOtherTag)
+  {
+    while(isspace(*str))
+      ++str;
+    const char* token_end = str;
+    while(*token_end && !isspace(*token_end))
+      ++token_end;
+    std::istringstream iss(std::string(str, token_end));
+    iss >> *val;
+    *end = token_end;
+  }
+  
+  template<class T>
+  void parseASCIIScalar(const char* str, const char** end, T* val)
+  {
+    parseASCIIScalar(str, end, val, typename ASCIIScalarTag<T>::type());
+  }
+
+  inline void parseASCIIScalar(const char* str, const char** end, double* val)
+  {
+    char* e;
+    *val = strtod(str, &e);
+    *end = e;
+  }
+
+  inline void parseASCIIScalar(const char* str, const char** end, float* val)
+  {
+    char* e;
+    *val = strtof(str, &e);
+    *end = e;
+  }
+
+  inline void parseASCIIScalar(const char* str, const char** end, int* val)
+  {
+    char* e;
+    *val = strtol(str, &e, 10);
+    *end = e;
+  }
+
+  template<class T>
+  int formatASCIIScalar(T val, char* buf, ASCIISignedTag)
+  {
+    return snprintf(buf, ASCII_SCALAR_BUFFER_SIZE, "%lld", (long long)val);
+  }
+
+  template<class T>
+  int formatASCIIScalar(T val, char* buf, ASCIIUnsignedTag)
+  {
+    return snprintf(buf, ASCII_SCALAR_BUFFER_SIZE, "%llu", (unsigned long long)val);
+  }
+
+  template<class T>
+  int formatASCIIScalar(T val, char* buf, ASCIIFloatingTag)
+  {
+    return formatASCIIScalar((double)val, buf);
   }
   
-  template<class S, int T, int U>
-  void serializeASCII(const Eigen::Matrix<S, T, U>& mat, std::ostream& strm)
+  template<class T>
+  int formatASCIIScalar(T val, char* buf)
+  {
+    return formatASCIIScalar(val, buf, typename ASCIIScalarTag<T>::type());
+  }
+  
+  //! Prints val with the fewest significant digits that parse back to
+  //! exactly val.  Every normal value whose shortest form has at most
+  //! DBL_DIG digits prints that way at %.<DBL_DIG>g, since %g drops
+  //! trailing zeros, so the search starts there.  Each later precision
+  //! tries the correctly rounded candidate of that length, so the first
+  //! that round-trips is shortest.  Subnormals have fewer significant
+  //! bits and are searched from one digit.
+  inline int formatASCIIScalar(double val, char* buf)
+  {
+    int len = 0;
+    int first = (val != 0 && fabs(val) < DBL_MIN) ? 1 : DBL_DIG;
+    for(int precision = first; precision <= 17; ++precision) {
+      len = snprintf(buf, ASCII_SCALAR_BUFFER_SIZE, "%.*g", precision, val);
+      if(strtod(buf, NULL) == val || val != val)
+        break;
+    }
+    return len;
+  }
+
+  inline int formatASCIIScalar(float val, char* buf)
+  {
+    int len = 0;
+    int first = (val != 0 && fabs(val) < FLT_MIN) ? 1 : FLT_DIG;
+    for(int precision = first; precision <= 9; ++precision) {
+      len = snprintf(buf, ASCII_SCALAR_BUFFER_SIZE, "%.*g", precision, val);
+      if(strtof(buf, NULL) == val || val != val)
+        break;
+    }
+    return len;
+  }
+
+  inline int formatASCIIScalar(int val, char* buf)
+  {
+    return snprintf(buf, ASCII_SCALAR_BUFFER_SIZE, "%d", val);
+  }
+
+  template<class T, class Tag>
+  void appendASCIIScalar(const T& val, std::string* str, Tag)
+  {
+    char buf[ASCII_SCALAR_BUFFER_SIZE];
+    str->append(buf, formatASCIIScalar(val, buf));
+  }
+
+  template<class T>
+  void appendASCIIScalar(const T& val, std::string* str, ASCIIOtherTag)
+  {
+    std::ostringstream oss;
+    oss.precision(17);
+    oss << val;
+    str->append(oss.str());
+  }
+
+  template<class T>
+  void appendASCIIScalar(const T& val, std::string* str)
+  {
+    appendASCIIScalar(val, str, typename ASCIIScalarTag<T>::type());
+  }
+  
+  template<class S, int T, int U, int O>
+  void serializeASCII(const Eigen::Matrix<S, T, U, O>& mat, std::ostream& strm)
   {
-    int old_precision = strm.precision();
-    strm.precision(16);
     strm << "% " << mat.rows() << " " << mat.cols() << std::endl;
-    strm << mat << std::endl;
-    strm.precision(old_precision);
+
+    // -- One write per row, no padding.  Readers only need whitespace.
+    std::string line;
+    line.reserve(mat.cols() * ASCII_SCALAR_BUFFER_SIZE);
+    for(int y = 0; y < mat.rows(); ++y) {
+      line.clear();
+      for(int x = 0; x < mat.cols(); ++x) {
+        if(x > 0)
+          line.push_back(' ');
+        appendASCIIScalar(mat.coeff(y, x), &line);
+      }
+      line.push_back('\n');
+      strm.write(line.data(), line.size());
+    }
   }
-      
-  template<class S, int T, int U>
-  void deserializeASCII(std::istream& strm, Eigen::Matrix<S, T, U>* mat)
+
+  //! Parses the "% rows cols" header line.  Returns a pointer past the parsed numbers.
+  inline const char* parseASCIIHeader(const char* str, int* rows, int* cols)
+  {
+    assert(str[0] == '%');
+    const char* ptr = str + 1;
+    parseASCIIScalar(ptr, &ptr, rows);
+    parseASCIIScalar(ptr, &ptr, cols);
+    return ptr;
+  }
+  
+  //! Parses rows [begin, end).  Row y spans [(*lines)[y], (*lines)[y + 1]).
+  //! Aborts on a row with too few values rather than reading on into the next.
+  template<class S, int T, int U, int O>
+  void parseASCIIRows(const std::vector<const char*>* lines, int begin, int end, Eigen::Matrix<S, T, U, O>* mat)
+  {
+    for(int y = begin; y < end; ++y) {
+      const char* ptr = (*lines)[y];
+      const char* line_end = (*lines)[y + 1];
+      for(int x = 0; x < mat->cols(); ++x) {
+        // -- Skip blanks here so the parser never crosses the newline.
+        while(ptr < line_end && (*ptr == ' ' || *ptr == '\t'))
+          ++ptr;
+        if(ptr == line_end || *ptr == '\n' || *ptr == '\r') {
+          std::cerr << "Row " << y << " of .eig.txt data has " << x << " values, expected "
+                    << mat->cols() << "." << std::endl;
+          abort();
+        }
+        parseASCIIScalar(ptr, &ptr, &mat->coeffRef(y, x));
+      }
+    }
+  }
+  
+  template<class S, int T, int U, int O>
+  void deserializeASCII(std::istream& strm, Eigen::Matrix<S, T, U, O>* mat)
   {
     // -- Read the header.
     std::string line;
     getline(strm, line);
-    assert(line[0] == '%');
-    std::istringstream iss(line.substr(1));
     int rows;
     int cols;
-    iss >> rows;
-    iss >> cols;
+    parseASCIIHeader(line.c_str(), &rows, &cols);
     
     // -- Read in the data.
-    *mat = Eigen::Matrix<S, T, U>(rows, cols);
+    mat->resize(rows, cols);
     for(int y = 0; y < rows; ++y) {
       getline(strm, line);
-      std::istringstream iss(line);
-      for(int x = 0; x < cols; ++x) {
-	iss >> mat->coeffRef(y, x);
+      const char* ptr = line.c_str();
+      for(int x = 0; x < cols; ++x)
+        parseASCIIScalar(ptr, &ptr, &mat->coeffRef(y, x));
+    }
+  }
+
+  template<class S, int T, int U, int O>
+  void deserializeASCII(const std::string& buf, Eigen::Matrix<S, T, U, O>* mat, int num_threads)
+  {
+    int rows;
+    int cols;
+    parseASCIIHeader(buf.c_str(), &rows, &cols);
+    mat->resize(rows, cols);
+    
+    // -- Find the start of each row, plus the end of the last one.
+    std::vector<const char*> lines(rows + 1);
+    const char* ptr = buf.c_str();
+    const char* end = ptr + buf.size();
+    for(int y = 0; y < rows; ++y) {
+      ptr = (const char*)memchr(ptr, '\n', end - ptr);
+      if(!ptr) {
+        std::cerr << ".eig.txt data has " << y << " rows, but its header says " << rows << "." << std::endl;
+        abort();
       }
+      ++ptr;
+      lines[y] = ptr;
+    }
+    lines[rows] = end;
+
+    // -- Parse.  Small inputs are not worth the threads.
+    if(num_threads <= 0)
+      num_threads = std::max<int>(1, boost::thread::hardware_concurrency());
+    if(buf.size() < (1 << 20))
+      num_threads = 1;
+    num_threads = std::min(num_threads, std::max(rows, 1));
+    if(num_threads == 1) {
+      parseASCIIRows(&lines, 0, rows, mat);
+      return;
     }
+
+    boost::thread_group threads;
+    for(int i = 0; i < num_threads; ++i) {
+      int begin = (int64_t)rows * i / num_threads;
+      int end = (int64_t)rows * (i + 1) / num_threads;
+      threads.create_thread(boost::bind(&parseASCIIRows<S, T, U, O>, &lines, begin, end, mat));
+    }
+    threads.join_all();
   }
 
-  template<class S, int T, int U>
-  void saveASCII(const Eigen::Matrix<S, T, U>& mat, const std::string& filename)
+  template<class S, int T, int U, int O>
+  void saveASCII(const Eigen::Matrix<S, T, U, O>& mat, const std::string& filename)
   {
     assert(filename.substr(filename.size() - 8).compare(".eig.txt") == 0);
     std::ofstream file;
@@ -267,8 +1853,8 @@ namespace eigen_extensions {
     file.close();
   }
   
-  template<class S, int T, int U>
-  void loadASCII(const std::string& filename, Eigen::Matrix<S, T, U>* mat)
+  template<class S, int T, int U, int O>
+  void loadASCII(const std::string& filename, Eigen::Matrix<S, T, U, O>* mat)
   {
     assert(filename.substr(filename.size() - 8).compare(".eig.txt") == 0);
     std::ifstream file;
@@ -276,8 +1862,14 @@ namespace eigen_extensions {
     if(!file)
       std::cerr << "File " << filename << " could not be opened.  Dying badly." << std::endl;
     assert(file);
-    deserializeASCII(file, mat);
+
+    // -- Slurp the file so it can be parsed in parallel.
+    file.seekg(0, std::ios::end);
+    std::string buf(file.tellg(), '\0');
+    file.seekg(0, std::ios::beg);
+    file.read(&buf[0], buf.size());
     file.close();
+    deserializeASCII(buf, mat);
   }
 
   template<class T>
@@ -0,0 +1,50 @@
+#ifndef EIGEN_EXTENSIONS_ENCODINGS_H
+#define EIGEN_EXTENSIONS_ENCODINGS_H
+
+#include <stdint.h>
+
+namespace eigen_extensions
+{
+
+  // -- Lossy storage encodings for float and double matrices.
+  //    Each outer vector (column, for column-major matrices) is encoded
+  //    independently.  EIG_AFFINE_INT8 vectors are preceded by a float
+  //    scale and offset; a code c decodes to offset + scale * c.
+
+  //! Values of EigHeader::encoding.  Never renumber these.
+  enum EigEncoding
+  {
+    //! Coefficients are stored as-is.
+    EIG_RAW = 0,
+    //! IEEE 754 binary16.
+    EIG_FLOAT16 = 1,
+    //! Upper half of an IEEE 754 binary32.
+    EIG_BFLOAT16 = 2,
+    //! uint8 codes with a per-vector scale and offset.
+    EIG_AFFINE_INT8 = 3
+  };
+
+  //! Bytes of scale and offset preceding each EIG_AFFINE_INT8 vector.
+  const int EIG_AFFINE_PARAMS_SIZE = 2 * sizeof(float);
+
+  //! e.g. "float16".  Returns "unknown" for unrecognized values.
+  const char* encodingName(int encoding);
+  //! Bytes per stored element for encoding, or 0 for EIG_RAW.
+  int encodedBytes(int encoding);
+
+  //! Round to nearest even; out-of-range values become infinity.
+  void encodeFloat16(const float* src, uint64_t num, uint16_t* dst);
+  void decodeFloat16(const uint16_t* src, uint64_t num, float* dst);
+  //! Round to nearest even.
+  void encodeBfloat16(const float* src, uint64_t num, uint16_t* dst);
+  void decodeBfloat16(const uint16_t* src, uint64_t num, float* dst);
+  //! Rounds (src - offset) / scale to the nearest code in [0, 255].
+  void encodeAffineInt8(const float* src, uint64_t num, float scale, float offset, uint8_t* dst);
+  void decodeAffineInt8(const uint8_t* src, uint64_t num, float scale, float offset, float* dst);
+
+  //! Chooses scale and offset so that [min, max] maps onto [0, 255].
+  void affineParams(float min, float max, float* scale, float* offset);
+  
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_ENCODINGS_H
@@ -0,0 +1,32 @@
+#ifndef EIGEN_EXTENSIONS_FILE_WRITER_H
+#define EIGEN_EXTENSIONS_FILE_WRITER_H
+
+#include <stdint.h>
+#include <string>
+#include <sys/uio.h>
+
+namespace eigen_extensions
+{
+
+  // -- Unbuffered file writes.
+  //    Uncompressed saves hand their header and payload straight to the
+  //    kernel with writev instead of copying them through an ofstream.
+
+  //! O_DIRECT writes go through a staging buffer of this many bytes.
+  const uint64_t DIRECT_IO_BUFFER_SIZE = 8 * 1024 * 1024;
+  //! Alignment of O_DIRECT buffers, offsets and lengths.
+  const uint64_t DIRECT_IO_ALIGNMENT = 4096;
+  //! Files smaller than this are not worth bypassing the page cache for.
+  const uint64_t DIRECT_IO_MIN_SIZE = 1024 * 1024;
+
+  //! Replaces filename with the concatenation of the iovcnt buffers in iov.
+  //! If direct_io is set, writes with O_DIRECT so the data does not fill
+  //! the page cache; filesystems without O_DIRECT get ordinary writes.
+  //! If preallocate is set, reserves the whole file with fallocate first.
+  //! Returns false, prints the reason, and leaves errno set on failure.
+  bool writeFile(const std::string& filename, const struct iovec* iov, int iovcnt,
+                 bool direct_io = false, bool preallocate = false);
+
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_FILE_WRITER_H
@@ -0,0 +1,94 @@
+#ifndef EIGEN_EXTENSIONS_FILTERS_H
+#define EIGEN_EXTENSIONS_FILTERS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+namespace eigen_extensions
+{
+
+  // -- Byte shuffle.
+  //    Stores byte k of every element together, so that the slowly
+  //    varying sign and exponent bytes of floating point data form long
+  //    runs that compress well.
+
+  //! Transposes num elements of width bytes each from src into dst.
+  void shuffleBytes(const char* src, uint64_t num, int width, char* dst);
+  //! Inverse of shuffleBytes().
+  void unshuffleBytes(const char* src, uint64_t num, int width, char* dst);
+  //! Unshuffles num elements whose byte planes start stride bytes apart,
+  //! e.g. a piece of a longer shuffled array.
+  void unshuffleBytes(const char* src, uint64_t stride, uint64_t num, int width, char* dst);
+
+
+  // -- LEB128 varints.
+
+  //! Appends val to dst, seven bits per byte.
+  void encodeVarint(uint64_t val, std::string* dst);
+  //! Decodes one varint from src and returns a pointer just past it.
+  const char* decodeVarint(const char* src, uint64_t* val);
+  //! Decodes num varints from src into dest and returns a pointer just past them.
+  //! src must have at least 8 readable bytes past the last varint.
+  template<class T>
+  const char* decodeVarints(const char* src, uint64_t num, T* dest);
+
+  //! Number of bytes decodeVarints() may read past the end of its input.
+  const int VARINT_OVERREAD = 8;
+  
+
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+
+  inline void encodeVarint(uint64_t val, std::string* dst)
+  {
+    while(val >= 0x80) {
+      dst->push_back((char)(val | 0x80));
+      val >>= 7;
+    }
+    dst->push_back((char)val);
+  }
+
+  inline const char* decodeVarint(const char* src, uint64_t* val)
+  {
+    uint64_t result = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+      byte = *src++;
+      result |= (uint64_t)(byte & 0x7f) << shift;
+      shift += 7;
+    } while(byte & 0x80);
+    *val = result;
+    return src;
+  }
+  
+  template<class T>
+  const char* decodeVarints(const char* src, uint64_t num, T* dest)
+  {
+    uint64_t i = 0;
+    while(i < num) {
+      // -- Fast path: if none of the next eight bytes has its continuation
+      //    bit set, they are eight one-byte varints.
+      uint64_t word;
+      memcpy(&word, src, sizeof(word));
+      if(i + 8 <= num && (word & 0x8080808080808080ULL) == 0) {
+        for(int j = 0; j < 8; ++j)
+          dest[i + j] = (unsigned char)src[j];
+        src += 8;
+        i += 8;
+        continue;
+      }
+
+      uint64_t val;
+      src = decodeVarint(src, &val);
+      dest[i] = val;
+      ++i;
+    }
+    return src;
+  }
+  
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_FILTERS_H
@@ -0,0 +1,184 @@
+#ifndef EIGEN_EXTENSIONS_MAPPED_MATRIX_H
+#define EIGEN_EXTENSIONS_MAPPED_MATRIX_H
+
+#include <eigen_extensions/eigen_extensions.h>
+#include <boost/shared_ptr.hpp>
+
+namespace eigen_extensions
+{
+
+  //! Read-only mmap of an entire file.  The mapping is released on destruction.
+  class MappedFile
+  {
+  public:
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+    const char* data() const { return data_; }
+    uint64_t size() const { return size_; }
+    
+  protected:
+    std::string filename_;
+    const char* data_;
+    uint64_t size_;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+  };
+
+  //! Zero-copy view of an uncompressed .eig file.
+  //! Pages are faulted in lazily and shared between processes through the page cache.
+  //! Copies share the underlying mapping, which stays alive as long as any copy does.
+  template<class S, int T, int U>
+  class MappedMatrix
+  {
+  public:
+    typedef Eigen::Map<const Eigen::Matrix<S, T, U>, Eigen::Aligned> MapType;
+
+    MappedMatrix(const std::string& filename);
+    const MapType& matrix() const { return map_; }
+    const EigHeader& header() const { return header_; }
+    boost::shared_ptr<MappedFile> file() const { return file_; }
+    
+  protected:
+    boost::shared_ptr<MappedFile> file_;
+    EigHeader header_;
+    MapType map_;
+
+    static EigHeader checkedHeader(const MappedFile& file);
+  };
+
+  //! Zero-copy view of a version 2 sparse .eig file.  The stored compressed
+  //! arrays are used in place, so read-only sparse matrices can be shared
+  //! between processes with near-zero startup.
+  template<class ScalarType, int Options = 0, class IndexType = int>
+  class MappedSparseMatrix
+  {
+  public:
+#if EIGEN_VERSION_AT_LEAST(3,3,0)
+    typedef Eigen::Map<const Eigen::SparseMatrix<ScalarType, Options, IndexType> > MapType;
+#else
+    typedef Eigen::MappedSparseMatrix<ScalarType, Options, IndexType> MapType;
+#endif
+
+    MappedSparseMatrix(const std::string& filename);
+    const MapType& matrix() const { return map_; }
+    const EigSparseHeader& header() const { return header_; }
+    boost::shared_ptr<MappedFile> file() const { return file_; }
+    
+  protected:
+    boost::shared_ptr<MappedFile> file_;
+    EigSparseHeader header_;
+    MapType map_;
+
+    static EigSparseHeader checkedHeader(const MappedFile& file);
+    template<class T> T* array(uint64_t offset) const { return (T*)(file_->data() + offset); }
+  };
+  
+  //! Convenience function; the returned object owns the mapping.
+  //! e.g. mapMatrix<Eigen::MatrixXf>("features.eig").matrix().col(13)
+  template<class MatrixType>
+  MappedMatrix<typename MatrixType::Scalar, MatrixType::RowsAtCompileTime, MatrixType::ColsAtCompileTime>
+  mapMatrix(const std::string& filename);
+
+  
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+
+  template<class S, int T, int U>
+  MappedMatrix<S, T, U>::MappedMatrix(const std::string& filename) :
+    file_(new MappedFile(filename)),
+    header_(checkedHeader(*file_)),
+    map_((const S*)(file_->data() + header_.dataOffset()), header_.rows, header_.cols)
+  {
+  }
+
+  template<class S, int T, int U>
+  EigHeader MappedMatrix<S, T, U>::checkedHeader(const MappedFile& file)
+  {
+    EigHeader header;
+    bool valid = parseHeader(file.data(), file.size(), &header);
+    if(!valid || header.version == 1) {
+      std::cerr << "MappedMatrix requires a version " << EIG_VERSION << " .eig file.  Re-save it with eigen_extensions::save()." << std::endl;
+      abort();
+    }
+    // Also rejects fixed-size shape mismatches.
+    checkHeader(header, Eigen::Matrix<S, T, U>());
+    if(needsTranspose(header, Eigen::Matrix<S, T, U>())) {
+      std::cerr << "MappedMatrix cannot map a matrix saved in the other storage order.  Use load() instead." << std::endl;
+      abort();
+    }
+    if(header.flags & EIG_SHUFFLED) {
+      std::cerr << "MappedMatrix cannot map a byte-shuffled file.  Use load() instead." << std::endl;
+      abort();
+    }
+    if(!isDirectlyReadable<S>(header)) {
+      std::cerr << "MappedMatrix cannot map a " << scalarTypeName(header.scalar_type) << " file with "
+                << encodingName(header.encoding) << " encoding into a " << scalarTypeName(EigScalarTraits<S>::type)
+                << " matrix.  Use load() instead." << std::endl;
+      abort();
+    }
+    // -- A mapping past EOF would raise SIGBUS on first access.
+    if(file.size() < header.dataOffset() + header.payloadSize()) {
+      std::cerr << "MappedMatrix: file is " << file.size() << " bytes but its header needs "
+                << header.dataOffset() + header.payloadSize() << "." << std::endl;
+      abort();
+    }
+    return header;
+  }
+
+  template<class ScalarType, int Options, class IndexType>
+  MappedSparseMatrix<ScalarType, Options, IndexType>::MappedSparseMatrix(const std::string& filename) :
+    file_(new MappedFile(filename)),
+    header_(checkedHeader(*file_)),
+    map_(header_.rowMajor() ? header_.outer : header_.inner,
+         header_.rowMajor() ? header_.inner : header_.outer,
+         header_.nnz,
+         array<IndexType>(header_.outerIndexOffset()),
+         array<IndexType>(header_.innerIndexOffset()),
+         array<ScalarType>(header_.valueOffset()))
+  {
+  }
+
+  template<class ScalarType, int Options, class IndexType>
+  EigSparseHeader MappedSparseMatrix<ScalarType, Options, IndexType>::checkedHeader(const MappedFile& file)
+  {
+    EigSparseHeader header;
+    if(!parseHeader(file.data(), file.size(), &header)) {
+      std::cerr << "MappedSparseMatrix requires a version " << EIG_VERSION << " sparse .eig file.  Re-save it with eigen_extensions::save()." << std::endl;
+      abort();
+    }
+    if(header.bytes != sizeof(ScalarType) || header.scalar_type != EigScalarTraits<ScalarType>::type ||
+       header.index_bytes != sizeof(IndexType)) {
+      std::cerr << "MappedSparseMatrix cannot map a " << scalarTypeName(header.scalar_type) << " file with "
+                << header.index_bytes << "-byte indices into a " << scalarTypeName(EigScalarTraits<ScalarType>::type)
+                << " matrix with " << sizeof(IndexType) << "-byte indices.  Use load() instead." << std::endl;
+      abort();
+    }
+    if(header.flags & (EIG_PACKED_INDICES | EIG_SHUFFLED)) {
+      std::cerr << "MappedSparseMatrix cannot map packed or shuffled sparse files." << std::endl;
+      abort();
+    }
+    if(header.rowMajor() != (bool)(Options & Eigen::RowMajorBit)) {
+      std::cerr << "MappedSparseMatrix cannot map a matrix saved in the other storage order.  Use load() instead." << std::endl;
+      abort();
+    }
+    if(file.size() < header.size()) {
+      std::cerr << "MappedSparseMatrix: file is " << file.size() << " bytes but its header needs "
+                << header.size() << "." << std::endl;
+      abort();
+    }
+    return header;
+  }
+  
+  template<class MatrixType>
+  MappedMatrix<typename MatrixType::Scalar, MatrixType::RowsAtCompileTime, MatrixType::ColsAtCompileTime>
+  mapMatrix(const std::string& filename)
+  {
+    typedef MappedMatrix<typename MatrixType::Scalar, MatrixType::RowsAtCompileTime, MatrixType::ColsAtCompileTime> Mapped;
+    return Mapped(filename);
+  }
+  
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_MAPPED_MATRIX_H
@@ -0,0 +1,123 @@
+#ifndef EIGEN_EXTENSIONS_PARALLEL_GZIP_H
+#define EIGEN_EXTENSIONS_PARALLEL_GZIP_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <zlib.h>
+
+namespace eigen_extensions
+{
+
+  //! pigz-style gzip compressor.  Buffered data is split into blocks
+  //! which are deflated independently on num_threads threads and
+  //! written out in order, so the result is readable by igzstream and
+  //! gunzip.  Data is buffered until a full batch of blocks is available
+  //! or the stream is closed.
+  //!
+  //! If blocked is false, the blocks form a single gzip member.
+  //! If blocked is true, each block is its own gzip member and an index
+  //! of member offsets is appended (see BlockedGzipReader).  The index
+  //! lives in the extra fields of empty trailing members, so gunzip
+  //! still outputs exactly the data that was written.
+  class ParallelGzipStreambuf : public std::streambuf
+  {
+  public:
+    ParallelGzipStreambuf();
+    ~ParallelGzipStreambuf();
+    //! num_threads <= 0 means use all cores.
+    ParallelGzipStreambuf* open(const std::string& filename, int num_threads,
+                                int level = Z_DEFAULT_COMPRESSION, bool blocked = false,
+                                size_t block_size = 128 * 1024);
+    ParallelGzipStreambuf* close();
+    bool is_open() const { return opened_; }
+    int numThreads() const { return num_threads_; }
+    
+  protected:
+    virtual int overflow(int c);
+
+  private:
+    std::ofstream file_;
+    bool opened_;
+    int num_threads_;
+    int level_;
+    bool blocked_;
+    size_t block_size_;
+    std::vector<char> buffer_;
+    std::vector<std::string> compressed_;
+    std::vector<uLong> crcs_;
+    uLong crc_;
+    uint64_t total_in_;
+    //! Bytes written to file_ so far.
+    uint64_t total_out_;
+    //! File offset of each gzip member, in blocked mode.
+    std::vector<uint64_t> member_offsets_;
+
+    //! Compresses and writes everything currently in the put area.
+    //! If finish is true, the final deflate block and gzip trailer are written.
+    bool flushBatch(bool finish);
+    void compressBlocks(const char* data, size_t len, size_t num_blocks, bool finish, int thread_id);
+    void write(const char* data, size_t len);
+    void writeIndex();
+  };
+
+  class ParallelGzipOstream : public std::ostream
+  {
+  public:
+    ParallelGzipOstream(const std::string& filename, int num_threads = 0,
+                        int level = Z_DEFAULT_COMPRESSION, bool blocked = false);
+    ~ParallelGzipOstream();
+    void close();
+    ParallelGzipStreambuf* rdbuf() { return &buf_; }
+    
+  protected:
+    ParallelGzipStreambuf buf_;
+  };
+
+  //! Random access into a file written by ParallelGzipStreambuf in blocked mode.
+  //! Blocks are inflated in parallel and only the blocks overlapping the
+  //! requested range are touched.
+  class BlockedGzipReader
+  {
+  public:
+    BlockedGzipReader(const std::string& filename);
+    ~BlockedGzipReader();
+    //! Total number of uncompressed bytes.
+    uint64_t size() const { return total_size_; }
+    uint64_t numBlocks() const { return member_offsets_.size(); }
+    //! Decompresses uncompressed bytes [offset, offset + len) into dest.
+    //! num_threads <= 0 means use all cores.
+    void read(uint64_t offset, uint64_t len, char* dest, int num_threads = 0) const;
+    
+  protected:
+    std::string filename_;
+    int fd_;
+    uint64_t block_size_;
+    uint64_t total_size_;
+    //! Offset of each data member, followed by the offset of the first index member.
+    std::vector<uint64_t> member_offsets_;
+
+    void readBlocks(uint64_t offset, uint64_t len, char* dest, int num_threads, int thread_id) const;
+    //! Inflates block idx into dest, which must have room for the whole block.
+    void inflateBlock(uint64_t idx, char* dest) const;
+    BlockedGzipReader(const BlockedGzipReader&);
+    BlockedGzipReader& operator=(const BlockedGzipReader&);
+  };
+
+  //! Returns true if filename was written by ParallelGzipStreambuf in blocked mode.
+  bool isBlockedGzip(const std::string& filename);
+  
+  //! Deflates len bytes of data as a raw deflate stream fragment.
+  //! If last is false, the output ends with a full flush so that fragments
+  //! can be concatenated into a single valid deflate stream.
+  void deflateBlock(const char* data, size_t len, int level, bool last, std::string* out);
+
+  //! Inflates a raw deflate stream into dest.  Returns true if the stream
+  //! ended and produced exactly dest_len bytes.
+  bool inflateRaw(const char* data, size_t len, char* dest, size_t dest_len);
+  
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_PARALLEL_GZIP_H
@@ -0,0 +1,124 @@
+#ifndef EIGEN_EXTENSIONS_PREFETCHER_H
+#define EIGEN_EXTENSIONS_PREFETCHER_H
+
+#include <eigen_extensions/eigen_extensions.h>
+#include <boost/shared_ptr.hpp>
+#include <map>
+
+namespace eigen_extensions
+{
+
+  //! Loads a list of files on background threads so that I/O and
+  //! decompression overlap with the consumer's computation.
+  //! Matrices are returned in the order of filenames.  At most
+  //! queue_depth files are loaded ahead of the consumer, which bounds
+  //! memory use.  MatrixType is anything load() accepts.
+  template<class MatrixType>
+  class EigPrefetcher
+  {
+  public:
+    //! num_threads <= 0 means use all cores.
+    EigPrefetcher(const std::vector<std::string>& filenames, int num_threads = 2, int queue_depth = 4);
+    //! Stops the workers after their current load.
+    ~EigPrefetcher();
+    //! Blocks until the next matrix is loaded and swaps it into mat.
+    //! Returns false once every file has been returned.
+    bool next(MatrixType* mat);
+    //! Index into filenames of the matrix the next call to next() will return.
+    size_t position() const { return next_to_return_; }
+    
+  protected:
+    std::vector<std::string> filenames_;
+    int queue_depth_;
+    boost::thread_group threads_;
+    boost::mutex mutex_;
+    boost::condition_variable cv_;
+    std::map<size_t, boost::shared_ptr<MatrixType> > ready_;
+    size_t next_to_load_;
+    size_t next_to_return_;
+    bool stop_;
+
+    void work();
+  };
+
+  
+  /************************************************************
+   * Template implementations
+   ************************************************************/
+
+  template<class MatrixType>
+  EigPrefetcher<MatrixType>::EigPrefetcher(const std::vector<std::string>& filenames, int num_threads, int queue_depth) :
+    filenames_(filenames),
+    queue_depth_(queue_depth),
+    next_to_load_(0),
+    next_to_return_(0),
+    stop_(false)
+  {
+    assert(queue_depth_ > 0);
+    if(num_threads <= 0)
+      num_threads = std::max<int>(1, boost::thread::hardware_concurrency());
+    for(int i = 0; i < num_threads; ++i)
+      threads_.create_thread(boost::bind(&EigPrefetcher::work, this));
+  }
+
+  template<class MatrixType>
+  EigPrefetcher<MatrixType>::~EigPrefetcher()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_all();
+    threads_.join_all();
+  }
+
+  template<class MatrixType>
+  void EigPrefetcher<MatrixType>::work()
+  {
+    while(true) {
+      size_t idx;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        while(!stop_ && next_to_load_ < filenames_.size() &&
+              next_to_load_ >= next_to_return_ + queue_depth_)
+          cv_.wait(lock);
+        if(stop_ || next_to_load_ >= filenames_.size())
+          return;
+        idx = next_to_load_;
+        ++next_to_load_;
+      }
+
+      boost::shared_ptr<MatrixType> mat(new MatrixType);
+      load(filenames_[idx], mat.get());
+      
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        ready_[idx] = mat;
+      }
+      cv_.notify_all();
+    }
+  }
+  
+  template<class MatrixType>
+  bool EigPrefetcher<MatrixType>::next(MatrixType* mat)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    if(next_to_return_ >= filenames_.size())
+      return false;
+    
+    while(!ready_.count(next_to_return_))
+      cv_.wait(lock);
+    typename std::map<size_t, boost::shared_ptr<MatrixType> >::iterator it = ready_.find(next_to_return_);
+    mat->swap(*it->second);
+    ready_.erase(it);
+    ++next_to_return_;
+    lock.unlock();
+    
+    // A slot opened up for the workers.
+    cv_.notify_all();
+    return true;
+  }
+  
+} // namespace
+
+#endif // EIGEN_EXTENSIONS_PREFETCHER_H
@@ -0,0 +1,206 @@
+#include <eigen_extensions/archive.h>
+
+using namespace std;
+
+namespace eigen_extensions
+{
+
+  static const char ARCHIVE_MAGIC[8] = {'\x89', 'E', 'I', 'G', 'A', 'R', 'C', '\n'};
+  static const int ARCHIVE_ALIGNMENT = 64;
+  
+  template<class T>
+  static void writePOD(const T& val, std::ostream& strm)
+  {
+    strm.write((const char*)&val, sizeof(T));
+  }
+
+  template<class T>
+  static void readPOD(std::istream& strm, T* val)
+  {
+    strm.read((char*)val, sizeof(T));
+  }
+  
+  ArchiveWriter::ArchiveWriter(const std::string& filename) :
+    filename_(filename)
+  {
+    file_.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!file_.is_open()) {
+      cerr << "File " << filename << " could not be opened.  Dying badly." << endl;
+      assert(file_.is_open());
+    }
+    file_.write(ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+  }
+
+  ArchiveWriter::~ArchiveWriter()
+  {
+    if(file_.is_open())
+      close();
+  }
+
+  void ArchiveWriter::pad()
+  {
+    uint64_t pos = file_.tellp();
+    uint64_t num = (ARCHIVE_ALIGNMENT - pos % ARCHIVE_ALIGNMENT) % ARCHIVE_ALIGNMENT;
+    char zeros[ARCHIVE_ALIGNMENT] = {0};
+    file_.write(zeros, num);
+  }
+  
+  void ArchiveWriter::beginEntry(const std::string& name)
+  {
+    assert(file_.is_open());
+    if(index_.count(name)) {
+      cerr << "Archive " << filename_ << " already has an entry named " << name << "." << endl;
+      assert(0);
+    }
+    
+    pad();
+    ArchiveEntry& entry = index_[name];
+    entry.offset = file_.tellp();
+    entry.stored_size = 0;
+    entry.size = 0;
+    entry.compressed = false;
+  }
+
+  void ArchiveWriter::addCompressed(const std::string& name, const std::string& data)
+  {
+    string compressed;
+    deflateBlock(data.data(), data.size(), Z_DEFAULT_COMPRESSION, true, &compressed);
+    
+    beginEntry(name);
+    ArchiveEntry& entry = index_[name];
+    entry.size = data.size();
+    entry.stored_size = compressed.size();
+    entry.compressed = true;
+    file_.write(compressed.data(), compressed.size());
+    assert(file_);
+  }
+  
+  void ArchiveWriter::close()
+  {
+    // -- Index: count, then (name length, name, offset, stored size, size, flags) per entry.
+    pad();
+    uint64_t index_offset = file_.tellp();
+    writePOD<uint64_t>(index_.size(), file_);
+    map<string, ArchiveEntry>::const_iterator it;
+    for(it = index_.begin(); it != index_.end(); ++it) {
+      writePOD<uint32_t>(it->first.size(), file_);
+      file_.write(it->first.data(), it->first.size());
+      writePOD<uint64_t>(it->second.offset, file_);
+      writePOD<uint64_t>(it->second.stored_size, file_);
+      writePOD<uint64_t>(it->second.size, file_);
+      writePOD<uint32_t>(it->second.compressed, file_);
+    }
+
+    // -- Trailer.
+    writePOD<uint64_t>(index_offset, file_);
+    file_.write(ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    file_.close();
+    assert(file_);
+  }
+
+  ArchiveReader::ArchiveReader(const std::string& filename) :
+    filename_(filename)
+  {
+    file_.open(filename.c_str(), ios::in | ios::binary);
+    if(!file_.is_open()) {
+      cerr << "File " << filename << " could not be opened." << endl;
+      abort();
+    }
+
+    // -- Trailer.
+    char magic[sizeof(ARCHIVE_MAGIC)];
+    uint64_t index_offset;
+    file_.seekg(0, ios::end);
+    uint64_t file_size = file_.tellg();
+    uint64_t trailer_size = sizeof(index_offset) + sizeof(magic);
+    if(!file_ || file_size < sizeof(ARCHIVE_MAGIC) + trailer_size) {
+      cerr << filename << " is too short to be an eigen_extensions archive." << endl;
+      abort();
+    }
+    file_.seekg(file_size - trailer_size);
+    readPOD(file_, &index_offset);
+    file_.read(magic, sizeof(magic));
+    if(!file_ || memcmp(magic, ARCHIVE_MAGIC, sizeof(magic)) != 0) {
+      cerr << filename << " is not an eigen_extensions archive." << endl;
+      abort();
+    }
+
+    // -- Index.  Every length is checked against the bytes left before
+    //    the trailer so that a corrupt index cannot cause a huge allocation.
+    uint64_t index_end = file_size - trailer_size;
+    if(index_offset < sizeof(ARCHIVE_MAGIC) || index_offset > index_end - sizeof(uint64_t)) {
+      cerr << "Archive " << filename << " has a corrupt index offset." << endl;
+      abort();
+    }
+    file_.seekg(index_offset);
+    uint64_t num;
+    readPOD(file_, &num);
+    uint64_t remaining = index_end - index_offset - sizeof(num);
+    static const uint64_t MIN_ENTRY_SIZE = 2 * sizeof(uint32_t) + 3 * sizeof(uint64_t);
+    bool valid = file_ && num <= remaining / MIN_ENTRY_SIZE;
+    for(uint64_t i = 0; valid && i < num; ++i) {
+      uint32_t len;
+      readPOD(file_, &len);
+      remaining -= MIN_ENTRY_SIZE;
+      if(!file_ || len > remaining) {
+        valid = false;
+        break;
+      }
+      remaining -= len;
+      string name(len, '\0');
+      file_.read(&name[0], len);
+      ArchiveEntry& entry = index_[name];
+      uint32_t compressed;
+      readPOD(file_, &entry.offset);
+      readPOD(file_, &entry.stored_size);
+      readPOD(file_, &entry.size);
+      readPOD(file_, &compressed);
+      entry.compressed = compressed;
+      valid = file_ && entry.offset <= index_offset && entry.stored_size <= index_offset - entry.offset &&
+        (entry.compressed || entry.size == entry.stored_size);
+    }
+    if(!valid) {
+      cerr << "Archive " << filename << " has a corrupt index." << endl;
+      abort();
+    }
+  }
+
+  std::vector<std::string> ArchiveReader::names() const
+  {
+    vector<string> names;
+    names.reserve(index_.size());
+    map<string, ArchiveEntry>::const_iterator it;
+    for(it = index_.begin(); it != index_.end(); ++it)
+      names.push_back(it->first);
+    return names;
+  }
+  
+  const ArchiveEntry& ArchiveReader::entry(const std::string& name) const
+  {
+    map<string, ArchiveEntry>::const_iterator it = index_.find(name);
+    if(it == index_.end()) {
+      cerr << "Archive " << filename_ << " has no entry named " << name << ".  Check contains() first." << endl;
+      abort();
+    }
+    return it->second;
+  }
+
+  void ArchiveReader::readCompressed(const std::string& name, const ArchiveEntry& entry, std::string* data)
+  {
+    string compressed(entry.stored_size, '\0');
+    file_.clear();
+    file_.seekg(entry.offset);
+    file_.read(&compressed[0], compressed.size());
+    if(!file_) {
+      cerr << "Entry " << name << " of archive " << filename_ << " is truncated." << endl;
+      abort();
+    }
+
+    data->resize(entry.size);
+    if(!inflateRaw(compressed.data(), compressed.size(), &(*data)[0], data->size())) {
+      cerr << "Corrupt entry " << name << " in archive " << filename_ << "." << endl;
+      abort();
+    }
+  }
+  
+} // namespace
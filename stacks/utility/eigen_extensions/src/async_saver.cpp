@@ -0,0 +1,95 @@
+#include <eigen_extensions/async_saver.h>
+
+using namespace std;
+
+namespace eigen_extensions
+{
+
+  AsyncSaver::AsyncSaver(uint64_t max_bytes, int num_threads) :
+    max_bytes_(max_bytes),
+    bytes_in_flight_(0),
+    num_running_(0),
+    quitting_(false)
+  {
+    assert(num_threads > 0);
+    for(int i = 0; i < num_threads; ++i)
+      threads_.create_thread(boost::bind(&AsyncSaver::run, this));
+  }
+
+  AsyncSaver::~AsyncSaver()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      quitting_ = true;
+    }
+    cond_.notify_all();
+    threads_.join_all();
+  }
+
+  void AsyncSaver::reserve(uint64_t bytes)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while(bytes_in_flight_ > 0 && bytes_in_flight_ + bytes > max_bytes_)
+      cond_.wait(lock);
+    bytes_in_flight_ += bytes;
+  }
+
+  void AsyncSaver::push(const Job& job, uint64_t bytes)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      queue_.push_back(make_pair(job, bytes));
+    }
+    cond_.notify_all();
+  }
+
+  void AsyncSaver::wait()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    while(!queue_.empty() || num_running_ > 0)
+      cond_.wait(lock);
+  }
+
+  uint64_t AsyncSaver::bytesInFlight() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return bytes_in_flight_;
+  }
+
+  void AsyncSaver::run()
+  {
+    while(true) {
+      pair<Job, uint64_t> job;
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        // Drain the queue before quitting so no submitted save is dropped.
+        while(queue_.empty() && !quitting_)
+          cond_.wait(lock);
+        if(queue_.empty())
+          return;
+        job = queue_.front();
+        queue_.pop_front();
+        ++num_running_;
+      }
+
+      // The packaged task stores any exception in its future.
+      job.first();
+      // Free the snapshot before releasing its bytes.
+      job.first.clear();
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        bytes_in_flight_ -= job.second;
+        --num_running_;
+      }
+      cond_.notify_all();
+    }
+  }
+
+  AsyncSaver& defaultAsyncSaver()
+  {
+    static AsyncSaver saver;
+    return saver;
+  }
+
+} // namespace
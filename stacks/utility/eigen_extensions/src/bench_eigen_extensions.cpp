@@ -0,0 +1,334 @@
+#include <eigen_extensions/eigen_extensions.h>
+#include <timer/timer.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <map>
+
+using namespace std;
+using namespace Eigen;
+
+// -- Save and load throughput for dense and sparse matrices.
+//    MB/s are computed from the in-memory size of the matrix, so
+//    compressed and uncompressed formats are directly comparable.
+//    Cold loads evict the file from the page cache first; warm loads
+//    read it straight after a previous load.
+
+struct Result
+{
+  string name;
+  //! In-memory bytes of the matrix.
+  double bytes;
+  //! On-disk bytes.
+  double file_bytes;
+  //! Median seconds per operation.
+  double save;
+  double load_warm;
+  double load_cold;
+
+  double mbps(double seconds) const { return bytes / seconds / (1 << 20); }
+};
+
+struct Settings
+{
+  string dir;
+  int reps;
+};
+
+//! Flushes filename to disk and asks the kernel to drop it from the page cache.
+//! Does not need root, unlike writing to /proc/sys/vm/drop_caches.
+bool evict(const string& filename)
+{
+  int fd = open(filename.c_str(), O_RDONLY);
+  if(fd < 0)
+    return false;
+  fsync(fd);
+  int retval = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+  close(fd);
+  return retval == 0;
+}
+
+double median(vector<double> vals)
+{
+  sort(vals.begin(), vals.end());
+  return vals[vals.size() / 2];
+}
+
+template<class MatrixType>
+void saveAny(const MatrixType& mat, const string& filename, const eigen_extensions::SaveOptions& opts)
+{
+  eigen_extensions::save(mat, filename, opts);
+}
+
+template<class MatrixType>
+void loadAny(const string& filename, MatrixType* mat)
+{
+  eigen_extensions::load(filename, mat);
+}
+
+void saveAny(const MatrixXf& mat, const string& filename, const eigen_extensions::SaveOptions& opts)
+{
+  if(filename.size() > 8 && filename.substr(filename.size() - 8).compare(".eig.txt") == 0)
+    eigen_extensions::saveASCII(mat, filename);
+  else
+    eigen_extensions::save(mat, filename, opts);
+}
+
+void loadAny(const string& filename, MatrixXf* mat)
+{
+  if(filename.size() > 8 && filename.substr(filename.size() - 8).compare(".eig.txt") == 0)
+    eigen_extensions::loadASCII(filename, mat);
+  else
+    eigen_extensions::load(filename, mat);
+}
+
+//! variant distinguishes runs of the same extension with different opts.
+template<class MatrixType>
+Result run(const string& name, const MatrixType& mat, double bytes, const string& extension,
+           const Settings& settings, const eigen_extensions::SaveOptions& opts = eigen_extensions::SaveOptions(),
+           const string& variant = "")
+{
+  Result result;
+  result.name = name + variant + extension;
+  result.bytes = bytes;
+  string filename = settings.dir + "/bench" + extension;
+
+  vector<double> saves;
+  for(int i = 0; i < settings.reps; ++i) {
+    HighResTimer hrt;
+    hrt.start();
+    saveAny(mat, filename, opts);
+    hrt.stop();
+    saves.push_back(hrt.getSeconds());
+  }
+  result.save = median(saves);
+  result.file_bytes = boost::filesystem::file_size(filename);
+
+  MatrixType mat2;
+  vector<double> warm;
+  loadAny(filename, &mat2);
+  for(int i = 0; i < settings.reps; ++i) {
+    HighResTimer hrt;
+    hrt.start();
+    loadAny(filename, &mat2);
+    hrt.stop();
+    warm.push_back(hrt.getSeconds());
+  }
+  result.load_warm = median(warm);
+
+  vector<double> cold;
+  for(int i = 0; i < settings.reps; ++i) {
+    if(!evict(filename))
+      cerr << "Could not evict " << filename << " from the page cache; cold numbers are warm." << endl;
+    HighResTimer hrt;
+    hrt.start();
+    loadAny(filename, &mat2);
+    hrt.stop();
+    cold.push_back(hrt.getSeconds());
+  }
+  result.load_cold = median(cold);
+
+  boost::filesystem::remove(filename);
+  return result;
+}
+
+SparseMatrix<float> randomSparse(int rows, int cols, double density)
+{
+  vector< Triplet<float> > triplets;
+  int64_t nnz = (int64_t)(density * rows * cols);
+  triplets.reserve(nnz);
+  for(int64_t i = 0; i < nnz; ++i)
+    triplets.push_back(Triplet<float>(rand() % rows, rand() % cols, (float)rand() / RAND_MAX));
+  SparseMatrix<float> mat(rows, cols);
+  mat.setFromTriplets(triplets.begin(), triplets.end());
+  return mat;
+}
+
+void print(const Result& r)
+{
+  printf("%-48s %10.1f MB %10.1f MB  save %8.1f MB/s %9.3f ms  warm %8.1f MB/s %9.3f ms  cold %8.1f MB/s %9.3f ms\n",
+         r.name.c_str(), r.bytes / (1 << 20), r.file_bytes / (1 << 20),
+         r.mbps(r.save), r.save * 1e3, r.mbps(r.load_warm), r.load_warm * 1e3,
+         r.mbps(r.load_cold), r.load_cold * 1e3);
+}
+
+// -- JSON.  One result per line so that readBaseline() does not need a real parser.
+
+void writeJSON(const vector<Result>& results, const string& filename)
+{
+  FILE* file = fopen(filename.c_str(), "w");
+  assert(file);
+  fprintf(file, "{\"results\": [\n");
+  for(size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    fprintf(file, "  {\"name\": \"%s\", \"bytes\": %.0f, \"file_bytes\": %.0f, "
+            "\"save_s\": %.9g, \"load_warm_s\": %.9g, \"load_cold_s\": %.9g, "
+            "\"save_mbps\": %.6g, \"load_warm_mbps\": %.6g, \"load_cold_mbps\": %.6g}%s\n",
+            r.name.c_str(), r.bytes, r.file_bytes, r.save, r.load_warm, r.load_cold,
+            r.mbps(r.save), r.mbps(r.load_warm), r.mbps(r.load_cold),
+            (i + 1 < results.size()) ? "," : "");
+  }
+  fprintf(file, "]}\n");
+  fclose(file);
+}
+
+bool readField(const string& line, const string& key, double* val)
+{
+  size_t pos = line.find("\"" + key + "\": ");
+  if(pos == string::npos)
+    return false;
+  *val = strtod(line.c_str() + pos + key.size() + 4, NULL);
+  return true;
+}
+
+map<string, Result> readBaseline(const string& filename)
+{
+  map<string, Result> baseline;
+  ifstream file(filename.c_str());
+  if(!file) {
+    cerr << "Could not open baseline " << filename << endl;
+    exit(1);
+  }
+
+  string line;
+  while(getline(file, line)) {
+    size_t pos = line.find("\"name\": \"");
+    if(pos == string::npos)
+      continue;
+    pos += 9;
+    Result r;
+    r.name = line.substr(pos, line.find('"', pos) - pos);
+    bool valid = readField(line, "bytes", &r.bytes) && readField(line, "file_bytes", &r.file_bytes) &&
+      readField(line, "save_s", &r.save) && readField(line, "load_warm_s", &r.load_warm) &&
+      readField(line, "load_cold_s", &r.load_cold);
+    if(valid)
+      baseline[r.name] = r;
+  }
+  return baseline;
+}
+
+//! Prints the change in throughput for each result and returns the number
+//! that are more than tolerance slower than the baseline.
+int compare(const vector<Result>& results, const map<string, Result>& baseline, double tolerance)
+{
+  int num_regressions = 0;
+  cout << endl << "Comparison against baseline (tolerance " << tolerance * 100 << "%):" << endl;
+  for(size_t i = 0; i < results.size(); ++i) {
+    const Result& r = results[i];
+    map<string, Result>::const_iterator it = baseline.find(r.name);
+    if(it == baseline.end()) {
+      printf("%-48s not in baseline\n", r.name.c_str());
+      continue;
+    }
+    const Result& b = it->second;
+    double ratios[] = {b.save / r.save, b.load_warm / r.load_warm, b.load_cold / r.load_cold};
+    const char* labels[] = {"save", "warm", "cold"};
+    printf("%-48s", r.name.c_str());
+    for(int j = 0; j < 3; ++j) {
+      bool regressed = ratios[j] < 1.0 - tolerance;
+      printf("  %s %+7.1f%%%s", labels[j], (ratios[j] - 1.0) * 100, regressed ? " REGRESSION" : "");
+      num_regressions += regressed;
+    }
+    printf("\n");
+  }
+  return num_regressions;
+}
+
+void die()
+{
+  cout << "Usage: bench_eigen_extensions [--quick] [--reps N] [--dir DIR] [--json FILE] [--baseline FILE] [--tolerance T]" << endl;
+  cout << "  --quick        small sizes only" << endl;
+  cout << "  --reps N       repetitions per measurement; the median is reported.  Default 5." << endl;
+  cout << "  --dir DIR      directory for temporary files; use the disk you care about.  Default ." << endl;
+  cout << "  --json FILE    write results to FILE" << endl;
+  cout << "  --baseline F   compare against JSON from a previous run and exit nonzero on regressions" << endl;
+  cout << "  --tolerance T  fractional slowdown allowed before a result counts as a regression.  Default 0.2." << endl;
+  exit(1);
+}
+
+int main(int argc, char** argv)
+{
+  Settings settings;
+  settings.dir = ".";
+  settings.reps = 5;
+  bool quick = false;
+  string json;
+  string baseline;
+  double tolerance = 0.2;
+  for(int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if(arg.compare("--quick") == 0)
+      quick = true;
+    else if(i + 1 == argc)
+      die();
+    else if(arg.compare("--reps") == 0)
+      settings.reps = atoi(argv[++i]);
+    else if(arg.compare("--dir") == 0)
+      settings.dir = argv[++i];
+    else if(arg.compare("--json") == 0)
+      json = argv[++i];
+    else if(arg.compare("--baseline") == 0)
+      baseline = argv[++i];
+    else if(arg.compare("--tolerance") == 0)
+      tolerance = atof(argv[++i]);
+    else
+      die();
+  }
+  if(settings.reps <= 0)
+    die();
+
+  vector<Result> results;
+
+  // -- Dense.  ASCII is slow, so it only runs on the smaller sizes.
+  eigen_extensions::SaveOptions shuffled;
+  shuffled.shuffle = true;
+  eigen_extensions::SaveOptions direct;
+  direct.direct_io = true;
+  direct.preallocate = true;
+  int sizes[] = {64, 512, 2048, 4096};
+  int num_sizes = quick ? 2 : 4;
+  for(int i = 0; i < num_sizes; ++i) {
+    MatrixXf mat = MatrixXf::Random(sizes[i], sizes[i]);
+    ostringstream oss;
+    oss << "dense_float_" << sizes[i] << "x" << sizes[i];
+    double bytes = sizeof(float) * mat.size();
+    results.push_back(run(oss.str(), mat, bytes, ".eig", settings));
+    print(results.back());
+    results.push_back(run(oss.str(), mat, bytes, ".eig.gz", settings));
+    print(results.back());
+    results.push_back(run(oss.str(), mat, bytes, ".eig.gz", settings, shuffled, "_shuffled"));
+    print(results.back());
+    results.push_back(run(oss.str(), mat, bytes, ".eig", settings, direct, "_direct"));
+    print(results.back());
+    if(sizes[i] <= 512) {
+      results.push_back(run(oss.str(), mat, bytes, ".eig.txt", settings));
+      print(results.back());
+    }
+  }
+
+  // -- Sparse.
+  int sparse_size = quick ? 2000 : 20000;
+  double densities[] = {0.0001, 0.001, 0.01};
+  for(int i = 0; i < 3; ++i) {
+    SparseMatrix<float> mat = randomSparse(sparse_size, sparse_size, densities[i]);
+    ostringstream oss;
+    oss << "sparse_float_" << sparse_size << "x" << sparse_size << "_density" << densities[i];
+    double bytes = (sizeof(float) + sizeof(int)) * mat.nonZeros() + sizeof(int) * (mat.outerSize() + 1);
+    results.push_back(run(oss.str(), mat, bytes, ".eig", settings));
+    print(results.back());
+    results.push_back(run(oss.str(), mat, bytes, ".eig.gz", settings));
+    print(results.back());
+  }
+
+  if(!json.empty()) {
+    writeJSON(results, json);
+    cout << "Wrote " << json << endl;
+  }
+
+  if(!baseline.empty()) {
+    int num_regressions = compare(results, readBaseline(baseline), tolerance);
+    cout << num_regressions << " regressions." << endl;
+    return num_regressions > 0 ? 1 : 0;
+  }
+
+  return 0;
+}
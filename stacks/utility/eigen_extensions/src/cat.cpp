@@ -1,39 +1,334 @@
 #include <eigen_extensions/eigen_extensions.h>
+#include <boost/scoped_ptr.hpp>
 
 using namespace std;
 using namespace Eigen;
+using namespace eigen_extensions;
 
-template<class T>
-void catMat(const string& filename) {
-  Matrix<T, Eigen::Dynamic, Eigen::Dynamic> mat;
-  eigen_extensions::load(filename, &mat);
-  if(mat.cols() == 1)
-    cout << mat.transpose() << endl;
-  else
-    cout << mat.transpose() << endl;
-}
-  
-void die() {
-  cout << "Usage: cat TYPE FILE" << endl;
-  cout << "  where TYPE is one of --int, --float, or --double and " << endl;
-  cout << "  FILE is a .eig file saved with eigen_extensions." << endl;
+// -- Prints a dense matrix one stored vector per line: a column per line
+//    for column-major files and a row per line for row-major files.
+//    Only the header and the selected range are read, and at most
+//    CAT_BUFFER_SIZE bytes of values are held in memory at once, so cat
+//    is safe to run on files much larger than RAM.  The exception is a
+//    byte-shuffled vector in a compressed file, which is read whole.
+
+//! Bytes of values read at a time.
+const uint64_t CAT_BUFFER_SIZE = 1 << 22;
+
+//! Half-open range [begin, end).  end < 0 means through the last index.
+struct Range
+{
+  int64_t begin;
+  int64_t end;
+
+  Range() : begin(0), end(-1) {}
+  int64_t size() const { return end - begin; }
+  void clamp(int64_t num)
+  {
+    if(end < 0 || end > num)
+      end = num;
+    begin = min(begin, end);
+  }
+};
+
+//! Formats into a large buffer and writes it with fwrite, which is much
+//! faster than operator<< on a matrix.  Values are formatted by
+//! appendASCIIScalar(), so output matches saveASCII().
+class Printer
+{
+public:
+  Printer() { buf_.reserve(PRINTER_BUFFER_SIZE + ASCII_SCALAR_BUFFER_SIZE); }
+  ~Printer() { flush(); }
+  template<class T>
+  void print(const T& val) { appendASCIIScalar(val, &buf_); flushIfFull(); }
+  void put(char c) { buf_.push_back(c); flushIfFull(); }
+  void flush() { fwrite(buf_.data(), 1, buf_.size(), stdout); buf_.clear(); }
+
+private:
+  static const size_t PRINTER_BUFFER_SIZE = 1 << 16;
+  std::string buf_;
+
+  void flushIfFull() { if(buf_.size() >= PRINTER_BUFFER_SIZE) flush(); }
+};
+
+void die()
+{
+  cout << "Usage: cat [--info] [--rows BEGIN END] [--cols BEGIN END] [TYPE] FILE" << endl;
+  cout << "  FILE is a .eig, .eig.gz, .eig.lz4, or .eig.zst file saved with eigen_extensions." << endl;
+  cout << "  --info          print the type, shape, and size from the header and exit" << endl;
+  cout << "  --rows B E      print only rows [B, E)" << endl;
+  cout << "  --cols B E      print only columns [B, E)" << endl;
+  cout << "  TYPE            --int, --float, or --double.  Only needed for version 1 files," << endl;
+  cout << "                  which do not record their scalar type." << endl;
+  cout << "  Prints one column per line, or one row per line for row-major files." << endl;
+  cout << "  Memory use is bounded except for byte-shuffled .gz, .lz4, and .zst files, which" << endl;
+  cout << "  are read one whole column, or row, at a time." << endl;
   exit(0);
 }
 
-int main(int argc, char** argv) {
-  if(argc != 3)
-    die();
+bool endsWith(const string& str, const string& suffix)
+{
+  return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+//! Opens filename with the stream load() would use.  Only plain .eig files can seek.
+istream* openStream(const string& filename, bool* seekable)
+{
+  *seekable = false;
+  if(endsWith(filename, ".gz"))
+    return new igzstream(filename.c_str());
+  if(isCodecFile(filename))
+    return new CodecIstream(filename);
+  *seekable = true;
+  return new ifstream(filename.c_str(), ios::in | ios::binary);
+}
 
-  string type(argv[1]);
-  string filename(argv[2]);
-  if(type.compare("--int") == 0)
-    catMat<int>(filename);
-  else if(type.compare("--float") == 0)
-    catMat<float>(filename);
-  else if(type.compare("--double") == 0)
-    catMat<double>(filename);
+void skip(istream& strm, uint64_t num, bool seekable)
+{
+  if(num == 0)
+    return;
+  if(seekable)
+    strm.seekg(num, ios::cur);
   else
+    strm.ignore(num);
+}
+
+//! e.g. "1.5 GB".
+string humanBytes(uint64_t num)
+{
+  const char* units[] = {"bytes", "KB", "MB", "GB", "TB"};
+  double val = num;
+  int unit = 0;
+  while(val >= 1024 && unit < 4) {
+    val /= 1024;
+    ++unit;
+  }
+  ostringstream oss;
+  oss.precision(unit == 0 ? 0 : 3);
+  oss << fixed << val << " " << units[unit];
+  return oss.str();
+}
+
+void printInfo(const string& filename, const EigHeader& header)
+{
+  cout << filename << ": dense " << scalarTypeName(header.scalar_type) << " matrix, "
+       << header.rows << " x " << header.cols << ", " << (header.rowMajor() ? "row-major" : "column-major")
+       << ", " << encodingName(header.encoding) << " encoding";
+  if(header.flags & EIG_SHUFFLED)
+    cout << ", byte-shuffled";
+  cout << ", version " << header.version << ", " << humanBytes(header.payloadSize()) << " payload, "
+       << humanBytes(boost::filesystem::file_size(filename)) << " on disk" << endl;
+}
+
+void printInfo(const string& filename, const EigSparseHeader& header)
+{
+  int64_t rows = header.rowMajor() ? header.outer : header.inner;
+  int64_t cols = header.rowMajor() ? header.inner : header.outer;
+  cout << filename << ": sparse " << scalarTypeName(header.scalar_type) << " matrix, "
+       << rows << " x " << cols << ", " << (header.rowMajor() ? "row-major" : "column-major")
+       << ", " << header.nnz << " nonzeros";
+  if(header.flags & EIG_PACKED_INDICES)
+    cout << ", packed indices";
+  if(header.flags & EIG_SHUFFLED)
+    cout << ", byte-shuffled";
+  cout << ", version " << header.version << ", "
+       << humanBytes(boost::filesystem::file_size(filename)) << " on disk" << endl;
+}
+
+template<class S>
+void printValues(const S* vals, int64_t num, bool first, Printer* printer)
+{
+  for(int64_t i = 0; i < num; ++i) {
+    if(!first || i > 0)
+      printer->put(' ');
+    printer->print(vals[i]);
+  }
+}
+
+//! Decodes num unshuffled coefficients at src into dst, using decoded as scratch.
+template<class S>
+void decodeValues(const char* src, int64_t num, const EigHeader& header, float scale, float offset,
+                  float* decoded, S* dst)
+{
+  if(isDirectlyReadable<S>(header)) {
+    memcpy(dst, src, num * sizeof(S));
+    return;
+  }
+  if(header.encoding == EIG_RAW) {
+    convertScalars(src, header.scalar_type, num, dst);
+    return;
+  }
+  const float* out = decodeChunk(src, num, header, scale, offset, NULL, decoded);
+  for(int64_t i = 0; i < num; ++i)
+    dst[i] = out[i];
+}
+
+//! Streams the selected stored vectors, and the selected range of each, to stdout.
+template<class S>
+void catDense(istream& strm, bool seekable, const EigHeader& header, const Range& outer, const Range& inner)
+{
+  checkHeader(header, Matrix<S, Dynamic, Dynamic>());
+  int64_t inner_size = header.innerSize();
+  uint64_t vector_size = header.vectorSize();
+  skip(strm, outer.begin * vector_size, seekable);
+  Printer printer;
+
+  // -- Vectors too large for the buffer are read piecewise.  Shuffled
+  //    vectors need a seek per byte plane, so only plain .eig files can
+  //    stream them; compressed ones are read a whole vector at a time.
+  bool shuffled = header.flags & EIG_SHUFFLED;
+  if(vector_size > CAT_BUFFER_SIZE && (!shuffled || seekable)) {
+    int64_t chunk = CAT_BUFFER_SIZE / (header.bytes + sizeof(float) + sizeof(S));
+    int64_t num_chunk = min(chunk, max<int64_t>(1, inner.size()));
+    vector<char> raw(num_chunk * header.bytes);
+    vector<char> planes(shuffled ? raw.size() : 0);
+    vector<float> decoded(num_chunk);
+    vector<S> buf(num_chunk);
+    uint64_t params = vector_size - header.bytes * inner_size;
+    for(int64_t i = outer.begin; i < outer.end; ++i) {
+      uint64_t start = seekable ? (uint64_t)strm.tellg() : 0;
+      float scale = 0;
+      float offset = 0;
+      if(header.encoding == EIG_AFFINE_INT8) {
+        strm.read((char*)&scale, sizeof(float));
+        strm.read((char*)&offset, sizeof(float));
+      }
+      if(!shuffled)
+        skip(strm, inner.begin * header.bytes, seekable);
+      for(int64_t j = inner.begin; j < inner.end; j += chunk) {
+        int64_t num = min(chunk, inner.end - j);
+        if(shuffled) {
+          for(int k = 0; k < header.bytes; ++k) {
+            strm.seekg(start + params + k * inner_size + j);
+            strm.read(&planes[k * num], num);
+          }
+          unshuffleBytes(&planes[0], num, num, header.bytes, &raw[0]);
+        }
+        else
+          strm.read(&raw[0], num * header.bytes);
+        decodeValues(&raw[0], num, header, scale, offset, &decoded[0], &buf[0]);
+        printValues(&buf[0], num, j == inner.begin, &printer);
+      }
+      if(shuffled)
+        strm.seekg(start + vector_size);
+      else
+        skip(strm, (inner_size - inner.end) * header.bytes, seekable);
+      printer.put('\n');
+    }
+    assert(strm);
+    return;
+  }
+
+  // -- Otherwise whole vectors, as many as fit.
+  int64_t batch = max<int64_t>(1, CAT_BUFFER_SIZE / max<uint64_t>(1, sizeof(S) * inner_size));
+  batch = min(batch, max<int64_t>(1, outer.size()));
+  vector<S> buf(batch * inner_size);
+  for(int64_t i = outer.begin; i < outer.end; i += batch) {
+    int64_t num = min(batch, outer.end - i);
+    readVectors(strm, header, num, buf.empty() ? NULL : &buf[0]);
+    for(int64_t j = 0; j < num; ++j) {
+      if(inner.size() > 0)
+        printValues(&buf[j * inner_size + inner.begin], inner.size(), true, &printer);
+      printer.put('\n');
+    }
+  }
+  assert(strm);
+}
+
+int main(int argc, char** argv)
+{
+  bool info = false;
+  string type;
+  Range rows;
+  Range cols;
+  string filename;
+  for(int i = 1; i < argc; ++i) {
+    string arg(argv[i]);
+    if(arg.compare("--info") == 0)
+      info = true;
+    else if(arg.compare("--int") == 0 || arg.compare("--float") == 0 || arg.compare("--double") == 0)
+      type = arg;
+    else if((arg.compare("--rows") == 0 || arg.compare("--cols") == 0) && i + 2 < argc) {
+      Range* range = (arg.compare("--rows") == 0) ? &rows : &cols;
+      range->begin = atoll(argv[++i]);
+      range->end = atoll(argv[++i]);
+      if(range->begin < 0 || range->end < range->begin)
+        die();
+    }
+    else if(filename.empty() && arg.compare(0, 2, "--") != 0)
+      filename = arg;
+    else
+      die();
+  }
+  if(filename.empty())
     die();
+  if(!boost::filesystem::exists(filename)) {
+    cerr << filename << " does not exist." << endl;
+    return 1;
+  }
+
+  bool seekable;
+  boost::scoped_ptr<istream> strm(openStream(filename, &seekable));
+  if(!*strm) {
+    cerr << "Could not open " << filename << endl;
+    return 1;
+  }
+
+  // -- Sparse files.
+  char magic[sizeof(EIG_SPARSE_MAGIC)];
+  strm->read(magic, sizeof(magic));
+  if(*strm && memcmp(magic, EIG_SPARSE_MAGIC, sizeof(magic)) == 0) {
+    strm.reset(openStream(filename, &seekable));
+    EigSparseHeader header;
+    deserializeHeader(*strm, &header);
+    printInfo(filename, header);
+    if(!info) {
+      cerr << "cat prints the values of dense matrices only." << endl;
+      return 1;
+    }
+    return 0;
+  }
+  strm.reset(openStream(filename, &seekable));
+
+  EigHeader header;
+  deserializeHeader(*strm, &header);
+  if(info) {
+    printInfo(filename, header);
+    return 0;
+  }
+
+  rows.clamp(header.rows);
+  cols.clamp(header.cols);
+  const Range& outer = header.rowMajor() ? rows : cols;
+  const Range& inner = header.rowMajor() ? cols : rows;
+
+  // -- Print in the saved type, widening integers.  Encoded values decode to float.
+  switch(header.scalar_type) {
+  case EIG_INT8: case EIG_INT16: case EIG_INT32: case EIG_INT64:
+    catDense<int64_t>(*strm, seekable, header, outer, inner);
+    break;
+  case EIG_UINT8: case EIG_UINT16: case EIG_UINT32: case EIG_UINT64:
+    catDense<uint64_t>(*strm, seekable, header, outer, inner);
+    break;
+  case EIG_FLOAT32:
+    catDense<float>(*strm, seekable, header, outer, inner);
+    break;
+  case EIG_FLOAT64:
+    catDense<double>(*strm, seekable, header, outer, inner);
+    break;
+  default:
+    if(type.compare("--int") == 0)
+      catDense<int>(*strm, seekable, header, outer, inner);
+    else if(type.compare("--float") == 0)
+      catDense<float>(*strm, seekable, header, outer, inner);
+    else if(type.compare("--double") == 0)
+      catDense<double>(*strm, seekable, header, outer, inner);
+    else {
+      cerr << filename << " is a version 1 file, which does not record its scalar type.  "
+           << "Pass --int, --float, or --double." << endl;
+      return 1;
+    }
+  }
 
   return 0;
 }
@@ -0,0 +1,470 @@
+#include <eigen_extensions/codecs.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <zlib.h>
+#include <string.h>
+#include <assert.h>
+#include <map>
+#ifdef EIGEN_EXTENSIONS_HAVE_LZ4
+#include <lz4.h>
+#include <lz4hc.h>
+#endif
+#ifdef EIGEN_EXTENSIONS_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+using namespace std;
+
+namespace eigen_extensions
+{
+
+  // Batches hold this many blocks per thread so that all threads have work.
+  static const int BLOCKS_PER_THREAD = 4;
+
+  static void encodeLittleEndian(uint64_t val, int bytes, char* buf)
+  {
+    for(int i = 0; i < bytes; ++i)
+      buf[i] = (val >> (8 * i)) & 0xff;
+  }
+
+  static uint64_t decodeLittleEndian(const char* buf, int bytes)
+  {
+    uint64_t val = 0;
+    for(int i = 0; i < bytes; ++i)
+      val |= (uint64_t)(unsigned char)buf[i] << (8 * i);
+    return val;
+  }
+
+
+  // -- Built-in codecs.
+
+#ifdef EIGEN_EXTENSIONS_HAVE_LZ4
+  //! Levels below LZ4HC_CLEVEL_MIN use the fast compressor.
+  class LZ4Codec : public Codec
+  {
+  public:
+    const char* name() const { return "lz4"; }
+    const char* extension() const { return ".lz4"; }
+    int defaultLevel() const { return 1; }
+    size_t bound(size_t len) const { return LZ4_compressBound(len); }
+
+    size_t compress(const char* src, size_t len, char* dest, size_t dest_len, int level) const
+    {
+      int num;
+      if(level < LZ4HC_CLEVEL_MIN)
+        num = LZ4_compress_default(src, dest, len, dest_len);
+      else
+        num = LZ4_compress_HC(src, dest, len, dest_len, level);
+      return num > 0 ? num : 0;
+    }
+
+    bool decompress(const char* src, size_t len, char* dest, size_t dest_len) const
+    {
+      return LZ4_decompress_safe(src, dest, len, dest_len) == (int)dest_len;
+    }
+  };
+#endif
+
+#ifdef EIGEN_EXTENSIONS_HAVE_ZSTD
+  class ZstdCodec : public Codec
+  {
+  public:
+    const char* name() const { return "zstd"; }
+    const char* extension() const { return ".zst"; }
+    int defaultLevel() const { return ZSTD_CLEVEL_DEFAULT; }
+    size_t bound(size_t len) const { return ZSTD_compressBound(len); }
+
+    size_t compress(const char* src, size_t len, char* dest, size_t dest_len, int level) const
+    {
+      size_t num = ZSTD_compress(dest, dest_len, src, len, level);
+      return ZSTD_isError(num) ? 0 : num;
+    }
+
+    bool decompress(const char* src, size_t len, char* dest, size_t dest_len) const
+    {
+      size_t num = ZSTD_decompress(dest, dest_len, src, len);
+      return !ZSTD_isError(num) && num == dest_len;
+    }
+  };
+#endif
+
+  // Constructed on first use so that registration from other static
+  // initializers works.
+  static map<int, const Codec*>& registry()
+  {
+    static map<int, const Codec*> codecs;
+    return codecs;
+  }
+
+  //! Registers the built-in codecs during static initialization.
+  struct BuiltinCodecs
+  {
+    BuiltinCodecs()
+    {
+#ifdef EIGEN_EXTENSIONS_HAVE_LZ4
+      static LZ4Codec lz4;
+      registerCodec(EIG_CODEC_LZ4, &lz4);
+#endif
+#ifdef EIGEN_EXTENSIONS_HAVE_ZSTD
+      static ZstdCodec zstd;
+      registerCodec(EIG_CODEC_ZSTD, &zstd);
+#endif
+    }
+  };
+  static BuiltinCodecs builtin_codecs;
+
+  void registerCodec(int id, const Codec* codec)
+  {
+    assert(id != EIG_CODEC_NONE);
+    registry()[id] = codec;
+  }
+
+  const Codec* findCodec(int id)
+  {
+    map<int, const Codec*>::const_iterator it = registry().find(id);
+    return it == registry().end() ? NULL : it->second;
+  }
+
+  int codecForFilename(const std::string& filename)
+  {
+    // Extensions of codecs that were not compiled in are still recognized,
+    // so that the caller gets an error rather than an uncompressed file.
+    if(filename.size() >= 4 && filename.substr(filename.size() - 4).compare(".lz4") == 0)
+      return EIG_CODEC_LZ4;
+    if(filename.size() >= 4 && filename.substr(filename.size() - 4).compare(".zst") == 0)
+      return EIG_CODEC_ZSTD;
+
+    map<int, const Codec*>::const_iterator it;
+    for(it = registry().begin(); it != registry().end(); ++it) {
+      string ext = it->second->extension();
+      if(filename.size() >= ext.size() && filename.substr(filename.size() - ext.size()).compare(ext) == 0)
+        return it->first;
+    }
+    return EIG_CODEC_NONE;
+  }
+
+  bool isCodecFile(const std::string& filename)
+  {
+    ifstream file(filename.c_str(), ios::in | ios::binary);
+    char magic[sizeof(CODEC_MAGIC)];
+    file.read(magic, sizeof(magic));
+    return file && memcmp(magic, CODEC_MAGIC, sizeof(magic)) == 0;
+  }
+
+
+  // -- Writing.
+
+  CodecOstreambuf::CodecOstreambuf() :
+    opened_(false),
+    codec_(NULL),
+    level_(0),
+    num_threads_(1),
+    block_size_(0)
+  {
+  }
+
+  CodecOstreambuf::~CodecOstreambuf()
+  {
+    close();
+  }
+
+  CodecOstreambuf* CodecOstreambuf::open(const std::string& filename, int codec_id, int level, int num_threads,
+                                         size_t block_size)
+  {
+    if(opened_)
+      return NULL;
+    codec_ = findCodec(codec_id);
+    if(!codec_) {
+      cerr << "Codec " << codec_id << " for " << filename << " is not available in this build." << endl;
+      return NULL;
+    }
+    assert(block_size < CODEC_STORED_BIT);
+
+    file_.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!file_.is_open())
+      return NULL;
+
+    level_ = (level == Z_DEFAULT_COMPRESSION) ? codec_->defaultLevel() : level;
+    num_threads_ = num_threads;
+    if(num_threads_ <= 0)
+      num_threads_ = max<int>(1, boost::thread::hardware_concurrency());
+    block_size_ = block_size;
+    buffer_.resize(block_size_ * num_threads_ * BLOCKS_PER_THREAD);
+    setp(&buffer_[0], &buffer_[0] + buffer_.size());
+    opened_ = true;
+
+    char header[CODEC_HEADER_SIZE];
+    memcpy(header, CODEC_MAGIC, sizeof(CODEC_MAGIC));
+    encodeLittleEndian(codec_id, 4, header + 4);
+    encodeLittleEndian(block_size_, 8, header + 8);
+    file_.write(header, sizeof(header));
+    return this;
+  }
+
+  CodecOstreambuf* CodecOstreambuf::close()
+  {
+    if(!opened_)
+      return NULL;
+    opened_ = false;
+
+    bool success = flushBatch();
+    char end[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    file_.write(end, sizeof(end));
+    file_.close();
+    success &= !file_.fail();
+    buffer_.clear();
+    compressed_.clear();
+    return success ? this : NULL;
+  }
+
+  int CodecOstreambuf::overflow(int c)
+  {
+    if(!opened_)
+      return EOF;
+    if(!flushBatch())
+      return EOF;
+    if(c != EOF) {
+      *pptr() = c;
+      pbump(1);
+    }
+    return c == EOF ? 0 : c;
+  }
+
+  void CodecOstreambuf::compressBlocks(const char* data, size_t len, size_t num_blocks, int thread_id)
+  {
+    for(size_t i = thread_id; i < num_blocks; i += num_threads_) {
+      size_t offset = i * block_size_;
+      size_t num = min(block_size_, len - offset);
+      string& out = compressed_[i];
+      out.resize(8 + codec_->bound(num));
+      size_t stored = codec_->compress(data + offset, num, &out[8], out.size() - 8, level_);
+      if(stored == 0 || stored >= num) {
+        memcpy(&out[8], data + offset, num);
+        stored = num | CODEC_STORED_BIT;
+      }
+      encodeLittleEndian(num, 4, &out[0]);
+      encodeLittleEndian(stored, 4, &out[4]);
+      out.resize(8 + (stored & ~CODEC_STORED_BIT));
+    }
+  }
+
+  bool CodecOstreambuf::flushBatch()
+  {
+    const char* data = pbase();
+    size_t len = pptr() - pbase();
+    size_t num_blocks = (len + block_size_ - 1) / block_size_;
+    if(num_blocks == 0)
+      return true;
+
+    compressed_.resize(num_blocks);
+    if(num_threads_ == 1 || num_blocks == 1)
+      compressBlocks(data, len, num_blocks, 0);
+    else {
+      boost::thread_group threads;
+      for(int i = 0; i < num_threads_; ++i)
+        threads.create_thread(boost::bind(&CodecOstreambuf::compressBlocks, this, data, len, num_blocks, i));
+      threads.join_all();
+    }
+
+    for(size_t i = 0; i < num_blocks; ++i)
+      file_.write(compressed_[i].data(), compressed_[i].size());
+    setp(&buffer_[0], &buffer_[0] + buffer_.size());
+    return !file_.fail();
+  }
+
+  CodecOstream::CodecOstream(const std::string& filename, int codec_id, int level, int num_threads) :
+    std::ostream(&buf_)
+  {
+    if(!buf_.open(filename, codec_id, level, num_threads))
+      setstate(ios::badbit);
+  }
+
+  CodecOstream::~CodecOstream()
+  {
+    buf_.close();
+  }
+
+  void CodecOstream::close()
+  {
+    if(buf_.is_open() && !buf_.close())
+      setstate(ios::badbit);
+  }
+
+
+  // -- Reading.
+
+  CodecIstreambuf::CodecIstreambuf() :
+    codec_(NULL),
+    num_threads_(1),
+    block_size_(0),
+    finished_(true),
+    num_blocks_(0)
+  {
+  }
+
+  CodecIstreambuf* CodecIstreambuf::open(const std::string& filename, int num_threads)
+  {
+    if(file_.is_open())
+      return NULL;
+    filename_ = filename;
+    file_.open(filename.c_str(), ios::in | ios::binary);
+    if(!file_.is_open())
+      return NULL;
+
+    char header[CODEC_HEADER_SIZE];
+    file_.read(header, sizeof(header));
+    if(!file_ || memcmp(header, CODEC_MAGIC, sizeof(CODEC_MAGIC)) != 0) {
+      cerr << filename << " is not a codec stream." << endl;
+      file_.close();
+      return NULL;
+    }
+    int codec_id = decodeLittleEndian(header + 4, 4);
+    codec_ = findCodec(codec_id);
+    if(!codec_) {
+      cerr << filename << " uses codec " << codec_id << ", which is not available in this build." << endl;
+      file_.close();
+      return NULL;
+    }
+
+    block_size_ = decodeLittleEndian(header + 8, 8);
+    num_threads_ = num_threads;
+    if(num_threads_ <= 0)
+      num_threads_ = max<int>(1, boost::thread::hardware_concurrency());
+    finished_ = false;
+    setg(NULL, NULL, NULL);
+    return this;
+  }
+
+  void CodecIstreambuf::close()
+  {
+    file_.close();
+    buffer_.clear();
+    compressed_.clear();
+    num_blocks_ = 0;
+    finished_ = true;
+    setg(NULL, NULL, NULL);
+  }
+
+  int CodecIstreambuf::underflow()
+  {
+    if(gptr() < egptr())
+      return traits_type::to_int_type(*gptr());
+    if(!readBatch())
+      return EOF;
+    return traits_type::to_int_type(*gptr());
+  }
+
+  void CodecIstreambuf::decompressBlocks(int thread_id)
+  {
+    for(size_t i = thread_id; i < num_blocks_; i += num_threads_) {
+      const string& in = compressed_[i];
+      char* dest = &buffer_[offsets_[i]];
+      if(!stored_[i])
+        valid_[i] = codec_->decompress(in.data(), in.size(), dest, raw_sizes_[i]);
+      else {
+        valid_[i] = (in.size() == raw_sizes_[i]);
+        if(valid_[i])
+          memcpy(dest, in.data(), in.size());
+      }
+    }
+  }
+
+  bool CodecIstreambuf::readBatch()
+  {
+    if(finished_)
+      return false;
+
+    // -- Read the next batch of compressed blocks.
+    size_t max_blocks = num_threads_ * BLOCKS_PER_THREAD;
+    compressed_.resize(max_blocks);
+    raw_sizes_.resize(max_blocks);
+    stored_.resize(max_blocks);
+    offsets_.resize(max_blocks);
+    valid_.resize(max_blocks);
+    num_blocks_ = 0;
+    uint64_t total = 0;
+    while(num_blocks_ < max_blocks) {
+      char prefix[8];
+      file_.read(prefix, sizeof(prefix));
+      if(!file_) {
+        cerr << filename_ << " is truncated." << endl;
+        finished_ = true;
+        return false;
+      }
+      uint32_t raw = decodeLittleEndian(prefix, 4);
+      uint32_t stored = decodeLittleEndian(prefix + 4, 4);
+      if(raw == 0) {
+        finished_ = true;
+        break;
+      }
+      if(raw > block_size_) {
+        cerr << filename_ << " has a block larger than its block size." << endl;
+        finished_ = true;
+        return false;
+      }
+
+      string& in = compressed_[num_blocks_];
+      in.resize(stored & ~CODEC_STORED_BIT);
+      if(!in.empty())
+        file_.read(&in[0], in.size());
+      if(!file_) {
+        cerr << filename_ << " is truncated." << endl;
+        finished_ = true;
+        return false;
+      }
+      raw_sizes_[num_blocks_] = raw;
+      stored_[num_blocks_] = (stored & CODEC_STORED_BIT) != 0;
+      offsets_[num_blocks_] = total;
+      total += raw;
+      ++num_blocks_;
+    }
+    if(num_blocks_ == 0)
+      return false;
+
+    // -- Decompress them in parallel.
+    buffer_.resize(total);
+    if(num_threads_ == 1 || num_blocks_ == 1)
+      decompressBlocks(0);
+    else {
+      boost::thread_group threads;
+      for(int i = 0; i < num_threads_; ++i)
+        threads.create_thread(boost::bind(&CodecIstreambuf::decompressBlocks, this, i));
+      threads.join_all();
+    }
+    for(size_t i = 0; i < num_blocks_; ++i) {
+      if(!valid_[i]) {
+        cerr << "Corrupt block in " << filename_ << "." << endl;
+        finished_ = true;
+        return false;
+      }
+    }
+
+    setg(&buffer_[0], &buffer_[0], &buffer_[0] + total);
+    return true;
+  }
+
+  CodecIstream::CodecIstream() :
+    std::istream(&buf_)
+  {
+  }
+
+  CodecIstream::CodecIstream(const std::string& filename, int num_threads) :
+    std::istream(&buf_)
+  {
+    open(filename, num_threads);
+  }
+
+  void CodecIstream::open(const std::string& filename, int num_threads)
+  {
+    if(!buf_.open(filename, num_threads))
+      setstate(ios::badbit);
+    else
+      clear();
+  }
+
+  void CodecIstream::close()
+  {
+    buf_.close();
+  }
+
+} // namespace
@@ -1,48 +1,275 @@
 #include <eigen_extensions/eigen_extensions.h>
+#include <timer/timer.h>
+#include <errno.h>
 
 using namespace std;
 using namespace Eigen;
+namespace bfs = boost::filesystem;
 
-void deserializeVector(std::istream& is, Eigen::VectorXd* target) {
+//! Reads an old format VectorXd: the number of rows as text on its own
+//! line, then the raw doubles.  Reads straight into target, so converting
+//! many vectors of the same length does not touch the heap.
+bool deserializeVector(std::istream& is, Eigen::VectorXd* target, uint64_t file_size) {
   int rows;
   string str;
   is >> rows;
   getline(is, str);
-  double* buf = (double*)malloc(sizeof(double)*rows);
-  is.read((char*)buf, sizeof(double)*rows);
-  VectorXd tmp = Eigen::Map<VectorXd>(buf, rows);
-  *target = tmp;
-  free(buf);
-  getline(is, str);
+  if(!is || rows < 0 || (uint64_t)rows * sizeof(double) > file_size)
+    return false;
+  target->resize(rows);
+  is.read((char*)target->data(), sizeof(double)*rows);
+  return !is.fail();
 }
 
-void deserializeVector(std::string filename, Eigen::VectorXd* target) {
+bool deserializeVector(std::string filename, Eigen::VectorXd* target) {
   ifstream file(filename.c_str());
   if(!file.is_open()) {
     cerr << "Unable to open " << filename << endl;
-    file.close();
+    return false;
+  }
+  return deserializeVector(file, target, bfs::file_size(filename));
+}
+
+//! True if filename starts with a .eig header.
+bool isConverted(const string& filename)
+{
+  char magic[sizeof(eigen_extensions::EIG_MAGIC)];
+  ifstream file(filename.c_str(), ios::in | ios::binary);
+  file.read(magic, sizeof(magic));
+  return file && memcmp(magic, eigen_extensions::EIG_MAGIC, sizeof(magic)) == 0;
+}
+
+//! True if filename has a current .eig header for a vector of rows
+//! values and is exactly as long as that header says.  Catches short
+//! writes that save() did not notice.
+bool isComplete(const string& filename, int64_t rows)
+{
+  char buf[eigen_extensions::EIG_HEADER_SIZE];
+  ifstream file(filename.c_str(), ios::in | ios::binary);
+  file.read(buf, sizeof(buf));
+  eigen_extensions::EigHeader header;
+  return eigen_extensions::parseHeader(buf, file.gcount(), &header) &&
+    header.version == eigen_extensions::EIG_VERSION && header.rows == rows && header.cols == 1 &&
+    bfs::file_size(filename) == header.dataOffset() + header.payloadSize();
+}
+
+
+// -- Batch mode.
+
+//! Appended to outputs while they are being written.
+const string TMP_SUFFIX = ".tmp.eig";
+
+struct Batch
+{
+  vector<string> inputs;
+  string suffix;
+  bool force;
+
+  boost::mutex mutex;
+  size_t next;
+  size_t num_converted;
+  size_t num_skipped;
+  size_t num_failed;
+  uint64_t bytes;
+};
+
+//! Output filename for input.
+string outputName(const Batch& batch, const string& input)
+{
+  return input + batch.suffix;
+}
+
+//! Converts input unless it or its output is already converted.
+//! Returns 1 if converted, 0 if skipped, and -1 on failure.
+int convertOne(const Batch& batch, const string& input, VectorXd* vec, uint64_t* bytes)
+{
+  string output = outputName(batch, input);
+  if(!batch.force) {
+    if(isConverted(input))
+      return 0;
+    if(bfs::exists(output) && bfs::last_write_time(output) >= bfs::last_write_time(input) && isConverted(output))
+      return 0;
+  }
+
+  if(!deserializeVector(input, vec)) {
+    cerr << "Failed to read " << input << endl;
+    return -1;
+  }
+
+  // -- Save to a temporary and rename it into place, so that an interrupted
+  //    run never leaves a partial file that a rerun would skip.
+  size_t slash = output.find_last_of('/') + 1;
+  string tmp = output.substr(0, slash) + "." + output.substr(slash) + TMP_SUFFIX;
+  if(!eigen_extensions::save(*vec, tmp) || !isComplete(tmp, vec->rows())) {
+    cerr << "Failed to write " << tmp << endl;
+    remove(tmp.c_str());
+    return -1;
+  }
+  if(rename(tmp.c_str(), output.c_str()) != 0) {
+    cerr << "Failed to write " << output << ": " << strerror(errno) << endl;
+    remove(tmp.c_str());
+    return -1;
+  }
+  *bytes += bfs::file_size(input);
+  return 1;
+}
+
+void convertWorker(Batch* batch)
+{
+  VectorXd vec;
+  while(true) {
+    string input;
+    {
+      boost::mutex::scoped_lock lock(batch->mutex);
+      if(batch->next == batch->inputs.size())
+        return;
+      input = batch->inputs[batch->next++];
+    }
+
+    uint64_t bytes = 0;
+    int result = convertOne(*batch, input, &vec, &bytes);
+
+    boost::mutex::scoped_lock lock(batch->mutex);
+    batch->bytes += bytes;
+    if(result > 0)
+      ++batch->num_converted;
+    else if(result == 0)
+      ++batch->num_skipped;
+    else
+      ++batch->num_failed;
+  }
+}
+
+//! Absolute path to filename with symlinks, "." and ".." resolved and
+//! repeated slashes removed.  Returns filename unchanged if it cannot be
+//! resolved, e.g. because it does not exist; convertOne() reports that.
+string canonicalPath(const string& filename)
+{
+  char* resolved = realpath(filename.c_str(), NULL);
+  if(!resolved)
+    return filename;
+  string path(resolved);
+  free(resolved);
+  return path;
+}
+
+bool endsWith(const string& str, const string& suffix)
+{
+  return str.size() >= suffix.size() && str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+//! Adds the regular files under path, or listed one per line in path if it is a file.
+void addInputs(const string& path, const string& suffix, vector<string>* inputs)
+{
+  if(bfs::is_directory(path)) {
+    for(bfs::recursive_directory_iterator it(path), end; it != end; ++it) {
+      string name = it->path().string();
+      // Skip our own outputs and temporaries.
+      if(bfs::is_regular_file(it->status()) && !endsWith(name, suffix) && !endsWith(name, TMP_SUFFIX))
+        inputs->push_back(name);
+    }
     return;
   }
 
-  deserializeVector(file, target);
-  file.close();
+  ifstream file(path.c_str());
+  if(!file.is_open()) {
+    cerr << "Unable to open " << path << endl;
+    exit(1);
+  }
+  string line;
+  while(getline(file, line))
+    if(!line.empty())
+      inputs->push_back(line);
+}
+
+int runBatch(Batch* batch, int num_threads)
+{
+  if(num_threads <= 0)
+    num_threads = max<int>(1, boost::thread::hardware_concurrency());
+  batch->next = 0;
+  batch->num_converted = 0;
+  batch->num_skipped = 0;
+  batch->num_failed = 0;
+  batch->bytes = 0;
+
+  HighResTimer hrt;
+  hrt.start();
+  boost::thread_group threads;
+  for(int i = 0; i < num_threads; ++i)
+    threads.create_thread(boost::bind(convertWorker, batch));
+  threads.join_all();
+  hrt.stop();
+
+  double seconds = hrt.getSeconds();
+  cout << "Converted " << batch->num_converted << ", skipped " << batch->num_skipped
+       << ", failed " << batch->num_failed << " of " << batch->inputs.size() << " files in "
+       << seconds << " seconds on " << num_threads << " threads." << endl;
+  if(seconds > 0)
+    cout << batch->num_converted / seconds << " files/s, "
+         << batch->bytes / seconds / (1 << 20) << " MB/s." << endl;
+  return batch->num_failed > 0 ? 1 : 0;
 }
 
+void die()
+{
+  cout << "Usage: convert OLD NEW" << endl;
+  cout << "  where OLD is an old format serialized Eigen::VectorXd and NEW is the eigen_extensions version." << endl;
+  cout << "Usage: convert --batch [--threads N] [--suffix S] [--force] PATH [PATH ...]" << endl;
+  cout << "  Converts every file under each directory PATH, or listed one per line in each" << endl;
+  cout << "  file PATH, to FILE.eig.  Files that are already .eig files, or whose output is" << endl;
+  cout << "  newer and valid, are skipped unless --force is given.  Symlinks are resolved," << endl;
+  cout << "  so outputs are written next to the files they point to." << endl;
+  cout << "  --threads N    0 means use all cores.  Default 0." << endl;
+  cout << "  --suffix S     appended to each input name.  Must end in .eig.  Default .eig." << endl;
+  exit(1);
+}
 
 int main(int argc, char** argv)
 {
-  if(argc != 3) {
-    cout << "Usage: convert OLD NEW" << endl;
-    cout << "  where OLD is an old format serialized Eigen::VectorXd and NEW is the eigen_extensions version." << endl;
-    return 1;
+  if(argc > 1 && string(argv[1]).compare("--batch") == 0) {
+    Batch batch;
+    batch.suffix = ".eig";
+    batch.force = false;
+    int num_threads = 0;
+    vector<string> paths;
+    for(int i = 2; i < argc; ++i) {
+      string arg(argv[i]);
+      if(arg.compare("--force") == 0)
+        batch.force = true;
+      else if(arg.compare("--threads") == 0 && i + 1 < argc)
+        num_threads = atoi(argv[++i]);
+      else if(arg.compare("--suffix") == 0 && i + 1 < argc)
+        batch.suffix = argv[++i];
+      else if(arg.compare(0, 2, "--") == 0)
+        die();
+      else
+        paths.push_back(arg);
+    }
+    if(paths.empty() || bfs::extension(batch.suffix).compare(".eig") != 0)
+      die();
+
+    for(size_t i = 0; i < paths.size(); ++i)
+      addInputs(paths[i], batch.suffix, &batch.inputs);
+    // -- Workers must not share a temporary, so each file is converted
+    //    once however it was named.
+    for(size_t i = 0; i < batch.inputs.size(); ++i)
+      batch.inputs[i] = canonicalPath(batch.inputs[i]);
+    sort(batch.inputs.begin(), batch.inputs.end());
+    batch.inputs.erase(unique(batch.inputs.begin(), batch.inputs.end()), batch.inputs.end());
+    return runBatch(&batch, num_threads);
   }
 
+  if(argc != 3)
+    die();
+
   VectorXd vec;
-  deserializeVector(argv[1], &vec);
-  eigen_extensions::save(vec, argv[2]);
+  if(!deserializeVector(argv[1], &vec))
+    return 1;
+  if(!eigen_extensions::save(vec, argv[2]))
+    return 1;
 
   cout << vec.transpose() << endl;
   cout << "Saved new vector into " << argv[2] << endl;
-  
+
   return 0;
 }
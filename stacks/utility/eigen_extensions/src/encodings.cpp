@@ -0,0 +1,178 @@
+#include <eigen_extensions/encodings.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace eigen_extensions
+{
+
+  const char* encodingName(int encoding)
+  {
+    static const char* names[] = {"raw", "float16", "bfloat16", "affine_int8"};
+    if(encoding < 0 || encoding > EIG_AFFINE_INT8)
+      return "unknown";
+    return names[encoding];
+  }
+
+  int encodedBytes(int encoding)
+  {
+    switch(encoding) {
+    case EIG_FLOAT16: return sizeof(uint16_t);
+    case EIG_BFLOAT16: return sizeof(uint16_t);
+    case EIG_AFFINE_INT8: return sizeof(uint8_t);
+    default: return 0;
+    }
+  }
+
+  static inline uint32_t floatBits(float f)
+  {
+    uint32_t u;
+    memcpy(&u, &f, sizeof(u));
+    return u;
+  }
+
+  static inline float bitsFloat(uint32_t u)
+  {
+    float f;
+    memcpy(&f, &u, sizeof(f));
+    return f;
+  }
+  
+  // Scalar conversions follow the usual bit-twiddling construction:
+  // subnormals are rounded by letting the FPU add a magic constant.
+  static inline uint16_t floatToHalf(float f)
+  {
+    const uint32_t f32_infinity = 255 << 23;
+    const uint32_t f16_overflow = (127 + 16) << 23;
+    const uint32_t denorm_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+
+    uint32_t u = floatBits(f);
+    uint32_t sign = u & 0x80000000u;
+    u ^= sign;
+
+    uint16_t h;
+    if(u >= f16_overflow)
+      h = (u > f32_infinity) ? 0x7e00 : 0x7c00;
+    else if(u < (113 << 23))
+      h = floatBits(bitsFloat(u) + bitsFloat(denorm_magic)) - denorm_magic;
+    else {
+      uint32_t odd = (u >> 13) & 1;
+      u += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+      h = u >> 13;
+    }
+    return h | (sign >> 16);
+  }
+
+  static inline float halfToFloat(uint16_t h)
+  {
+    const uint32_t shifted_exp = 0x7c00 << 13;
+    uint32_t u = (h & 0x7fff) << 13;
+    uint32_t exp = u & shifted_exp;
+    u += (127 - 15) << 23;
+    if(exp == shifted_exp)
+      u += (128 - 16) << 23;
+    else if(exp == 0) {
+      u += 1 << 23;
+      u = floatBits(bitsFloat(u) - bitsFloat(113 << 23));
+    }
+    return bitsFloat(u | ((uint32_t)(h & 0x8000) << 16));
+  }
+  
+  void encodeFloat16(const float* src, uint64_t num, uint16_t* dst)
+  {
+    uint64_t i = 0;
+#ifdef __F16C__
+    for(; i + 8 <= num; i += 8) {
+      __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), 0);
+      _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+#endif
+    for(; i < num; ++i)
+      dst[i] = floatToHalf(src[i]);
+  }
+
+  void decodeFloat16(const uint16_t* src, uint64_t num, float* dst)
+  {
+    uint64_t i = 0;
+#ifdef __F16C__
+    for(; i + 8 <= num; i += 8)
+      _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+#endif
+    for(; i < num; ++i)
+      dst[i] = halfToFloat(src[i]);
+  }
+
+  void encodeBfloat16(const float* src, uint64_t num, uint16_t* dst)
+  {
+    for(uint64_t i = 0; i < num; ++i) {
+      uint32_t u = floatBits(src[i]);
+      // Keep NaNs NaN rather than letting rounding carry into infinity.
+      if((u & 0x7fffffff) > 0x7f800000)
+        dst[i] = (u >> 16) | 0x40;
+      else
+        dst[i] = (u + 0x7fff + ((u >> 16) & 1)) >> 16;
+    }
+  }
+
+  void decodeBfloat16(const uint16_t* src, uint64_t num, float* dst)
+  {
+    uint64_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= num; i += 8) {
+      __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+      _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(zero, b));
+      _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(zero, b));
+    }
+#endif
+    for(; i < num; ++i)
+      dst[i] = bitsFloat((uint32_t)src[i] << 16);
+  }
+
+  void affineParams(float min, float max, float* scale, float* offset)
+  {
+    *offset = min;
+    *scale = (max - min) / 255.0f;
+  }
+  
+  void encodeAffineInt8(const float* src, uint64_t num, float scale, float offset, uint8_t* dst)
+  {
+    float inv = (scale > 0) ? 1.0f / scale : 0.0f;
+    for(uint64_t i = 0; i < num; ++i) {
+      float code = (src[i] - offset) * inv;
+      // Written so that NaNs map to zero.
+      if(!(code > 0.0f))
+        code = 0.0f;
+      if(code > 255.0f)
+        code = 255.0f;
+      dst[i] = (uint8_t)(code + 0.5f);
+    }
+  }
+
+  void decodeAffineInt8(const uint8_t* src, uint64_t num, float scale, float offset, float* dst)
+  {
+    uint64_t i = 0;
+#ifdef __SSE2__
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 s = _mm_set1_ps(scale);
+    const __m128 o = _mm_set1_ps(offset);
+    for(; i + 16 <= num; i += 16) {
+      __m128i b = _mm_loadu_si128((const __m128i*)(src + i));
+      __m128i lo = _mm_unpacklo_epi8(b, zero);
+      __m128i hi = _mm_unpackhi_epi8(b, zero);
+      __m128i w[4] = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+                      _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+      for(int j = 0; j < 4; ++j)
+        _mm_storeu_ps(dst + i + 4 * j, _mm_add_ps(o, _mm_mul_ps(s, _mm_cvtepi32_ps(w[j]))));
+    }
+#endif
+    for(; i < num; ++i)
+      dst[i] = offset + scale * src[i];
+  }
+  
+} // namespace
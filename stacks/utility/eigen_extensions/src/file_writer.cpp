@@ -0,0 +1,156 @@
+#include <eigen_extensions/file_writer.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+using namespace std;
+
+namespace eigen_extensions
+{
+
+  //! write() until done, retrying on EINTR and short writes.
+  static bool writeAll(int fd, const char* buf, uint64_t num)
+  {
+    while(num > 0) {
+      ssize_t written = write(fd, buf, num);
+      if(written < 0 && errno == EINTR)
+        continue;
+      if(written <= 0)
+        return false;
+      buf += written;
+      num -= written;
+    }
+    return true;
+  }
+
+  //! writev() until done.  iov is modified.
+  static bool writevAll(int fd, struct iovec* iov, int iovcnt)
+  {
+    while(iovcnt > 0) {
+      ssize_t written = writev(fd, iov, min(iovcnt, IOV_MAX));
+      if(written < 0 && errno == EINTR)
+        continue;
+      if(written < 0)
+        return false;
+
+      // -- Skip what was written, which may end partway through a buffer.
+      while(iovcnt > 0 && (size_t)written >= iov->iov_len) {
+        written -= iov->iov_len;
+        ++iov;
+        --iovcnt;
+      }
+      if(iovcnt > 0) {
+        iov->iov_base = (char*)iov->iov_base + written;
+        iov->iov_len -= written;
+      }
+    }
+    return true;
+  }
+
+  //! Copies the buffers through an aligned staging buffer so that every
+  //! write has the alignment O_DIRECT needs.  The last write is padded
+  //! to DIRECT_IO_ALIGNMENT; the caller truncates the padding away.
+  static bool writeDirect(int fd, const struct iovec* iov, int iovcnt)
+  {
+    void* ptr;
+    if(posix_memalign(&ptr, DIRECT_IO_ALIGNMENT, DIRECT_IO_BUFFER_SIZE) != 0)
+      return false;
+    char* buf = (char*)ptr;
+    uint64_t pos = 0;
+    bool success = true;
+    for(int i = 0; success && i < iovcnt; ++i) {
+      const char* src = (const char*)iov[i].iov_base;
+      uint64_t len = iov[i].iov_len;
+      while(success && len > 0) {
+        uint64_t num = min(len, DIRECT_IO_BUFFER_SIZE - pos);
+        memcpy(buf + pos, src, num);
+        pos += num;
+        src += num;
+        len -= num;
+        if(pos == DIRECT_IO_BUFFER_SIZE) {
+          success = writeAll(fd, buf, pos);
+          pos = 0;
+        }
+      }
+    }
+    if(success && pos > 0) {
+      uint64_t padded = (pos + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+      memset(buf + pos, 0, padded - pos);
+      success = writeAll(fd, buf, padded);
+    }
+    free(buf);
+    return success;
+  }
+
+  bool writeFile(const std::string& filename, const struct iovec* iov, int iovcnt,
+                 bool direct_io, bool preallocate)
+  {
+    uint64_t total = 0;
+    for(int i = 0; i < iovcnt; ++i)
+      total += iov[i].iov_len;
+
+    int fd = -1;
+    bool direct = false;
+#ifdef O_DIRECT
+    if(direct_io && total >= DIRECT_IO_MIN_SIZE) {
+      fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+      direct = (fd >= 0);
+    }
+#endif
+    if(fd < 0)
+      fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+      cerr << "Could not open " << filename << ": " << strerror(errno) << endl;
+      return false;
+    }
+
+#ifdef __linux__
+    // Filesystems and kernels that cannot preallocate just skip it.
+    if(preallocate && total > 0 && fallocate(fd, 0, 0, total) != 0 &&
+       errno != EOPNOTSUPP && errno != ENOSYS) {
+      int err = errno;
+      cerr << "Could not preallocate " << total << " bytes for " << filename << ": " << strerror(err) << endl;
+      close(fd);
+      errno = err;
+      return false;
+    }
+#endif
+
+    bool success;
+    if(direct) {
+      success = writeDirect(fd, iov, iovcnt);
+      // Some filesystems accept O_DIRECT at open() and reject the writes.
+      if(!success && errno == EINVAL) {
+        close(fd);
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        direct = false;
+      }
+    }
+    if(!direct) {
+      vector<struct iovec> copy(iov, iov + iovcnt);
+      success = (fd >= 0) && writevAll(fd, copy.empty() ? NULL : &copy[0], iovcnt);
+    }
+    // -- Remove padding from the last direct write and any unused preallocation.
+    if(success && ftruncate(fd, total) != 0)
+      success = false;
+    // -- Keep the first errno for the caller; close() may overwrite it.
+    int err = errno;
+    if(!success)
+      cerr << "Write to " << filename << " failed: " << strerror(err) << endl;
+    if(fd >= 0 && close(fd) != 0 && success) {
+      err = errno;
+      cerr << "Write to " << filename << " failed: " << strerror(err) << endl;
+      success = false;
+    }
+    if(!success)
+      errno = err;
+    return success;
+  }
+
+} // namespace
@@ -0,0 +1,131 @@
+#include <eigen_extensions/filters.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace eigen_extensions
+{
+
+#ifdef __SSE2__
+  // -- SSE2 byte transposes of 16 elements at a time.
+  //    Treat the 16 * W bytes held in W registers as indexed by bits
+  //    (register, byte).  One interleaveStep() rotates those bits left by
+  //    one, so the element-major (e, k) layout becomes the plane-major
+  //    (k, e) layout after four steps, and back after log2(W) more.
+
+  template<int W>
+  static inline void interleaveStep(__m128i* r)
+  {
+    __m128i t[W];
+    for(int i = 0; i < W / 2; ++i) {
+      t[2 * i] = _mm_unpacklo_epi8(r[i], r[i + W / 2]);
+      t[2 * i + 1] = _mm_unpackhi_epi8(r[i], r[i + W / 2]);
+    }
+    for(int i = 0; i < W; ++i)
+      r[i] = t[i];
+  }
+
+  template<int W> struct Log2 {};
+  template<> struct Log2<2> { static const int value = 1; };
+  template<> struct Log2<4> { static const int value = 2; };
+  template<> struct Log2<8> { static const int value = 3; };
+
+  //! Shuffles the first num - num % 16 elements.  Returns the number shuffled.
+  template<int W>
+  static uint64_t shuffleSSE2(const char* src, uint64_t num, char* dst)
+  {
+    __m128i r[W];
+    uint64_t i = 0;
+    for(; i + 16 <= num; i += 16) {
+      for(int j = 0; j < W; ++j)
+        r[j] = _mm_loadu_si128((const __m128i*)(src + i * W + 16 * j));
+      for(int step = 0; step < 4; ++step)
+        interleaveStep<W>(r);
+      for(int k = 0; k < W; ++k)
+        _mm_storeu_si128((__m128i*)(dst + k * num + i), r[k]);
+    }
+    return i;
+  }
+
+  template<int W>
+  static uint64_t unshuffleSSE2(const char* src, uint64_t stride, uint64_t num, char* dst)
+  {
+    __m128i r[W];
+    uint64_t i = 0;
+    for(; i + 16 <= num; i += 16) {
+      for(int k = 0; k < W; ++k)
+        r[k] = _mm_loadu_si128((const __m128i*)(src + k * stride + i));
+      for(int step = 0; step < Log2<W>::value; ++step)
+        interleaveStep<W>(r);
+      for(int j = 0; j < W; ++j)
+        _mm_storeu_si128((__m128i*)(dst + i * W + 16 * j), r[j]);
+    }
+    return i;
+  }
+#else
+  template<int W>
+  static uint64_t shuffleSSE2(const char*, uint64_t, char*) { return 0; }
+  template<int W>
+  static uint64_t unshuffleSSE2(const char*, uint64_t, uint64_t, char*) { return 0; }
+#endif
+
+  // Fixed-width versions let the compiler unroll the tail loops.
+  template<int W>
+  static void shuffleFixed(const char* src, uint64_t num, char* dst)
+  {
+    uint64_t begin = shuffleSSE2<W>(src, num, dst);
+    for(int k = 0; k < W; ++k) {
+      char* out = dst + k * num;
+      for(uint64_t i = begin; i < num; ++i)
+        out[i] = src[i * W + k];
+    }
+  }
+
+  template<int W>
+  static void unshuffleFixed(const char* src, uint64_t stride, uint64_t num, char* dst)
+  {
+    uint64_t begin = unshuffleSSE2<W>(src, stride, num, dst);
+    for(int k = 0; k < W; ++k) {
+      const char* in = src + k * stride;
+      for(uint64_t i = begin; i < num; ++i)
+        dst[i * W + k] = in[i];
+    }
+  }
+  
+  void shuffleBytes(const char* src, uint64_t num, int width, char* dst)
+  {
+    assert(src != dst);
+    switch(width) {
+    case 1: memcpy(dst, src, num); break;
+    case 2: shuffleFixed<2>(src, num, dst); break;
+    case 4: shuffleFixed<4>(src, num, dst); break;
+    case 8: shuffleFixed<8>(src, num, dst); break;
+    default:
+      for(int k = 0; k < width; ++k)
+        for(uint64_t i = 0; i < num; ++i)
+          dst[k * num + i] = src[i * width + k];
+    }
+  }
+
+  void unshuffleBytes(const char* src, uint64_t num, int width, char* dst)
+  {
+    unshuffleBytes(src, num, num, width, dst);
+  }
+
+  void unshuffleBytes(const char* src, uint64_t stride, uint64_t num, int width, char* dst)
+  {
+    assert(src != dst);
+    switch(width) {
+    case 1: memcpy(dst, src, num); break;
+    case 2: unshuffleFixed<2>(src, stride, num, dst); break;
+    case 4: unshuffleFixed<4>(src, stride, num, dst); break;
+    case 8: unshuffleFixed<8>(src, stride, num, dst); break;
+    default:
+      for(int k = 0; k < width; ++k)
+        for(uint64_t i = 0; i < num; ++i)
+          dst[i * width + k] = src[k * stride + i];
+    }
+  }
+  
+} // namespace
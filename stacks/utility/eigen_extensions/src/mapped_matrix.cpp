@@ -0,0 +1,52 @@
+#include <eigen_extensions/mapped_matrix.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+using namespace std;
+
+namespace eigen_extensions
+{
+
+  MappedFile::MappedFile(const std::string& filename) :
+    filename_(filename),
+    data_(NULL),
+    size_(0)
+  {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0) {
+      cerr << "File " << filename << " could not be opened: " << strerror(errno) << endl;
+      abort();
+    }
+
+    // -- On failure the file is left empty, which every header check rejects.
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+      cerr << "Failed to stat " << filename << ": " << strerror(errno) << endl;
+      close(fd);
+      return;
+    }
+
+    if(st.st_size > 0) {
+      void* addr = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if(addr == MAP_FAILED)
+        cerr << "Failed to mmap " << filename << ": " << strerror(errno) << endl;
+      else {
+        data_ = (const char*)addr;
+        size_ = st.st_size;
+      }
+    }
+
+    // The mapping holds its own reference to the file.
+    close(fd);
+  }
+
+  MappedFile::~MappedFile()
+  {
+    if(data_)
+      munmap((void*)data_, size_);
+  }
+  
+} // namespace
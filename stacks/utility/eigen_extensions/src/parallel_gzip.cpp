@@ -0,0 +1,501 @@
+#include <eigen_extensions/parallel_gzip.h>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <assert.h>
+
+using namespace std;
+
+namespace eigen_extensions
+{
+
+  // Batches hold this many blocks per thread so that all threads have work.
+  // Each batch is compressed and then written; the two do not overlap.
+  static const int BLOCKS_PER_THREAD = 4;
+
+  // -- Blocked gzip trailer.
+  //    Index members carry member offsets in an 'EI' extra subfield.
+  //    The locator is always the last GZ_LOCATOR_SIZE bytes of the file and
+  //    carries block size, number of blocks, total size, and index offset
+  //    in an 'EL' extra subfield.
+  static const size_t GZ_HEADER_SIZE = 10;
+  static const size_t GZ_TRAILER_SIZE = 8;
+  static const size_t GZ_EMPTY_BODY_SIZE = 2;
+  static const size_t GZ_MAX_EXTRA = 65535 - 4;
+  static const size_t GZ_INDEX_ENTRIES = GZ_MAX_EXTRA / sizeof(uint64_t);
+  static const size_t GZ_LOCATOR_EXTRA = 4 * sizeof(uint64_t);
+  static const size_t GZ_LOCATOR_SIZE = GZ_HEADER_SIZE + 2 + 4 + GZ_LOCATOR_EXTRA + GZ_EMPTY_BODY_SIZE + GZ_TRAILER_SIZE;
+  
+  static void encodeLittleEndian(uint64_t val, int bytes, char* buf)
+  {
+    for(int i = 0; i < bytes; ++i)
+      buf[i] = (val >> (8 * i)) & 0xff;
+  }
+
+  static uint64_t decodeLittleEndian(const char* buf, int bytes)
+  {
+    uint64_t val = 0;
+    for(int i = 0; i < bytes; ++i)
+      val |= (uint64_t)(unsigned char)buf[i] << (8 * i);
+    return val;
+  }
+
+  //! Builds an empty gzip member whose header carries one extra subfield.
+  static string emptyMemberWithExtra(char si1, char si2, const string& payload)
+  {
+    assert(payload.size() <= GZ_MAX_EXTRA);
+    string member(GZ_HEADER_SIZE + 2 + 4 + payload.size() + GZ_EMPTY_BODY_SIZE + GZ_TRAILER_SIZE, 0);
+    char* p = &member[0];
+    const unsigned char header[GZ_HEADER_SIZE] = {0x1f, 0x8b, 8, 4 /* FEXTRA */, 0, 0, 0, 0, 0, 3};
+    memcpy(p, header, GZ_HEADER_SIZE);
+    p += GZ_HEADER_SIZE;
+    encodeLittleEndian(4 + payload.size(), 2, p);
+    p += 2;
+    p[0] = si1;
+    p[1] = si2;
+    encodeLittleEndian(payload.size(), 2, p + 2);
+    p += 4;
+    memcpy(p, payload.data(), payload.size());
+    p += payload.size();
+    // Final stored block of zero length, then zero crc and size.
+    p[0] = 3;
+    p[1] = 0;
+    return member;
+  }
+  
+  void deflateBlock(const char* data, size_t len, int level, bool last, std::string* out)
+  {
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    // Negative window bits: raw deflate, no zlib header or trailer.
+    int retval = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+    assert(retval == Z_OK);
+
+    // Room for the worst case plus the flush marker.
+    out->resize(deflateBound(&zs, len) + 16);
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = len;
+    size_t num_out = 0;
+    int flush = last ? Z_FINISH : Z_FULL_FLUSH;
+    while(true) {
+      zs.next_out = (Bytef*)&(*out)[num_out];
+      zs.avail_out = out->size() - num_out;
+      retval = deflate(&zs, flush);
+      assert(retval == Z_OK || retval == Z_STREAM_END || retval == Z_BUF_ERROR);
+      num_out = out->size() - zs.avail_out;
+      if(last ? retval == Z_STREAM_END : (zs.avail_in == 0 && zs.avail_out > 0))
+        break;
+      out->resize(out->size() * 2);
+    }
+    out->resize(num_out);
+    deflateEnd(&zs);
+  }
+  
+  bool inflateRaw(const char* data, size_t len, char* dest, size_t dest_len)
+  {
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = (Bytef*)data;
+    zs.avail_in = len;
+    int retval = inflateInit2(&zs, -MAX_WBITS);
+    assert(retval == Z_OK);
+    zs.next_out = (Bytef*)dest;
+    zs.avail_out = dest_len;
+    retval = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    return retval == Z_STREAM_END && zs.avail_out == 0;
+  }
+  
+  ParallelGzipStreambuf::ParallelGzipStreambuf() :
+    opened_(false),
+    num_threads_(1),
+    level_(Z_DEFAULT_COMPRESSION),
+    blocked_(false),
+    block_size_(0),
+    crc_(0),
+    total_in_(0),
+    total_out_(0)
+  {
+  }
+
+  ParallelGzipStreambuf::~ParallelGzipStreambuf()
+  {
+    close();
+  }
+
+  ParallelGzipStreambuf* ParallelGzipStreambuf::open(const std::string& filename, int num_threads,
+                                                     int level, bool blocked, size_t block_size)
+  {
+    if(opened_)
+      return NULL;
+    
+    file_.open(filename.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!file_.is_open())
+      return NULL;
+
+    num_threads_ = num_threads;
+    if(num_threads_ <= 0)
+      num_threads_ = max<int>(1, boost::thread::hardware_concurrency());
+    level_ = level;
+    blocked_ = blocked;
+    block_size_ = block_size;
+    buffer_.resize(block_size_ * num_threads_ * BLOCKS_PER_THREAD);
+    setp(&buffer_[0], &buffer_[0] + buffer_.size());
+    crc_ = crc32(0L, Z_NULL, 0);
+    total_in_ = 0;
+    total_out_ = 0;
+    member_offsets_.clear();
+    opened_ = true;
+
+    // -- gzip member header: magic, deflate, no flags, no mtime, Unix.
+    if(!blocked_) {
+      const unsigned char header[GZ_HEADER_SIZE] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+      write((const char*)header, sizeof(header));
+    }
+    return this;
+  }
+
+  ParallelGzipStreambuf* ParallelGzipStreambuf::close()
+  {
+    if(!opened_)
+      return NULL;
+    opened_ = false;
+
+    bool success = flushBatch(true);
+    if(blocked_)
+      writeIndex();
+    else {
+      char trailer[GZ_TRAILER_SIZE];
+      encodeLittleEndian(crc_, 4, trailer);
+      encodeLittleEndian(total_in_ & 0xffffffff, 4, trailer + 4);
+      write(trailer, sizeof(trailer));
+    }
+    file_.close();
+    success &= !file_.fail();
+    
+    buffer_.clear();
+    compressed_.clear();
+    crcs_.clear();
+    return success ? this : NULL;
+  }
+  
+  int ParallelGzipStreambuf::overflow(int c)
+  {
+    if(!opened_)
+      return EOF;
+    if(!flushBatch(false))
+      return EOF;
+    if(c != EOF) {
+      *pptr() = c;
+      pbump(1);
+    }
+    return c == EOF ? 0 : c;
+  }
+
+  void ParallelGzipStreambuf::write(const char* data, size_t len)
+  {
+    file_.write(data, len);
+    total_out_ += len;
+  }
+  
+  void ParallelGzipStreambuf::writeIndex()
+  {
+    uint64_t index_offset = total_out_;
+    for(size_t i = 0; i < member_offsets_.size(); i += GZ_INDEX_ENTRIES) {
+      size_t num = min(GZ_INDEX_ENTRIES, member_offsets_.size() - i);
+      string payload(num * sizeof(uint64_t), 0);
+      for(size_t j = 0; j < num; ++j)
+        encodeLittleEndian(member_offsets_[i + j], sizeof(uint64_t), &payload[j * sizeof(uint64_t)]);
+      string member = emptyMemberWithExtra('E', 'I', payload);
+      write(member.data(), member.size());
+    }
+
+    string payload(GZ_LOCATOR_EXTRA, 0);
+    encodeLittleEndian(block_size_, sizeof(uint64_t), &payload[0]);
+    encodeLittleEndian(member_offsets_.size(), sizeof(uint64_t), &payload[8]);
+    encodeLittleEndian(total_in_, sizeof(uint64_t), &payload[16]);
+    encodeLittleEndian(index_offset, sizeof(uint64_t), &payload[24]);
+    string member = emptyMemberWithExtra('E', 'L', payload);
+    assert(member.size() == GZ_LOCATOR_SIZE);
+    write(member.data(), member.size());
+  }
+  
+  void ParallelGzipStreambuf::compressBlocks(const char* data, size_t len, size_t num_blocks, bool finish, int thread_id)
+  {
+    for(size_t i = thread_id; i < num_blocks; i += num_threads_) {
+      size_t offset = i * block_size_;
+      size_t num = min(block_size_, len - offset);
+      bool last = blocked_ || (finish && i == num_blocks - 1);
+      deflateBlock(data + offset, num, level_, last, &compressed_[i]);
+      crcs_[i] = crc32(0L, (const Bytef*)data + offset, num);
+    }
+  }
+  
+  bool ParallelGzipStreambuf::flushBatch(bool finish)
+  {
+    const char* data = pbase();
+    size_t len = pptr() - pbase();
+    size_t num_blocks = (len + block_size_ - 1) / block_size_;
+    // The final deflate block must exist even if there is no data left.
+    if(finish && !blocked_ && num_blocks == 0)
+      num_blocks = 1;
+    if(num_blocks == 0)
+      return true;
+    
+    compressed_.resize(num_blocks);
+    crcs_.resize(num_blocks);
+    if(num_threads_ == 1 || num_blocks == 1)
+      compressBlocks(data, len, num_blocks, finish, 0);
+    else {
+      boost::thread_group threads;
+      for(int i = 0; i < num_threads_; ++i)
+        threads.create_thread(boost::bind(&ParallelGzipStreambuf::compressBlocks, this, data, len, num_blocks, finish, i));
+      threads.join_all();
+    }
+
+    for(size_t i = 0; i < num_blocks; ++i) {
+      size_t num = min(block_size_, len - min(len, i * block_size_));
+      if(blocked_) {
+        member_offsets_.push_back(total_out_);
+        const unsigned char header[GZ_HEADER_SIZE] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3};
+        write((const char*)header, sizeof(header));
+        write(compressed_[i].data(), compressed_[i].size());
+        char trailer[GZ_TRAILER_SIZE];
+        encodeLittleEndian(crcs_[i], 4, trailer);
+        encodeLittleEndian(num, 4, trailer + 4);
+        write(trailer, sizeof(trailer));
+      }
+      else {
+        write(compressed_[i].data(), compressed_[i].size());
+        crc_ = crc32_combine(crc_, crcs_[i], num);
+      }
+    }
+    total_in_ += len;
+    setp(&buffer_[0], &buffer_[0] + buffer_.size());
+    return !file_.fail();
+  }
+
+  ParallelGzipOstream::ParallelGzipOstream(const std::string& filename, int num_threads, int level, bool blocked) :
+    std::ostream(&buf_)
+  {
+    if(!buf_.open(filename, num_threads, level, blocked))
+      setstate(ios::badbit);
+  }
+
+  ParallelGzipOstream::~ParallelGzipOstream()
+  {
+    buf_.close();
+  }
+
+  void ParallelGzipOstream::close()
+  {
+    if(buf_.is_open() && !buf_.close())
+      setstate(ios::badbit);
+  }
+
+  //! Reads exactly len bytes at offset.  Returns false on a short read.
+  static bool preadAll(int fd, char* buf, size_t len, uint64_t offset)
+  {
+    while(len > 0) {
+      ssize_t num = pread(fd, buf, len, offset);
+      if(num <= 0)
+        return false;
+      buf += num;
+      len -= num;
+      offset += num;
+    }
+    return true;
+  }
+
+  //! Parses the locator at the end of a blocked gzip file.
+  static bool parseLocator(const char* buf, uint64_t* block_size, uint64_t* num_blocks,
+                           uint64_t* total_size, uint64_t* index_offset)
+  {
+    const char* extra = buf + GZ_HEADER_SIZE + 2;
+    if((unsigned char)buf[0] != 0x1f || (unsigned char)buf[1] != 0x8b || !(buf[3] & 4) ||
+       decodeLittleEndian(buf + GZ_HEADER_SIZE, 2) != 4 + GZ_LOCATOR_EXTRA ||
+       extra[0] != 'E' || extra[1] != 'L' || decodeLittleEndian(extra + 2, 2) != GZ_LOCATOR_EXTRA)
+      return false;
+
+    extra += 4;
+    *block_size = decodeLittleEndian(extra, 8);
+    *num_blocks = decodeLittleEndian(extra + 8, 8);
+    *total_size = decodeLittleEndian(extra + 16, 8);
+    *index_offset = decodeLittleEndian(extra + 24, 8);
+    return true;
+  }
+
+  bool isBlockedGzip(const std::string& filename)
+  {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+      return false;
+
+    bool blocked = false;
+    struct stat st;
+    if(fstat(fd, &st) == 0 && (uint64_t)st.st_size >= GZ_LOCATOR_SIZE) {
+      char buf[GZ_LOCATOR_SIZE];
+      uint64_t block_size, num_blocks, total_size, index_offset;
+      blocked = preadAll(fd, buf, GZ_LOCATOR_SIZE, st.st_size - GZ_LOCATOR_SIZE) &&
+        parseLocator(buf, &block_size, &num_blocks, &total_size, &index_offset);
+    }
+    close(fd);
+    return blocked;
+  }
+  
+  BlockedGzipReader::BlockedGzipReader(const std::string& filename) :
+    filename_(filename),
+    fd_(-1),
+    block_size_(0),
+    total_size_(0)
+  {
+    fd_ = open(filename.c_str(), O_RDONLY);
+    if(fd_ < 0) {
+      cerr << "File " << filename << " could not be opened: " << strerror(errno) << endl;
+      abort();
+    }
+
+    // -- Read the locator.
+    struct stat st;
+    if(fstat(fd_, &st) != 0) {
+      cerr << "Failed to stat " << filename << ": " << strerror(errno) << endl;
+      abort();
+    }
+    uint64_t file_size = st.st_size;
+    char locator[GZ_LOCATOR_SIZE];
+    uint64_t num_blocks = 0;
+    uint64_t index_offset = 0;
+    bool valid = file_size >= GZ_LOCATOR_SIZE &&
+      preadAll(fd_, locator, GZ_LOCATOR_SIZE, file_size - GZ_LOCATOR_SIZE) &&
+      parseLocator(locator, &block_size_, &num_blocks, &total_size_, &index_offset);
+    // A zero block size would divide by zero in every lookup.
+    if(!valid || index_offset > file_size - GZ_LOCATOR_SIZE || block_size_ == 0 ||
+       num_blocks != (total_size_ + block_size_ - 1) / block_size_) {
+      cerr << filename << " is not a blocked gzip file." << endl;
+      abort();
+    }
+
+    // -- Read the index members that sit between the data and the locator.
+    string index(file_size - GZ_LOCATOR_SIZE - index_offset, 0);
+    if(!index.empty() && !preadAll(fd_, &index[0], index.size(), index_offset)) {
+      cerr << "Failed to read the index of " << filename << ": " << strerror(errno) << endl;
+      abort();
+    }
+    if(num_blocks > index.size() / sizeof(uint64_t)) {
+      cerr << "Index of " << filename << " is too short for " << num_blocks << " blocks." << endl;
+      abort();
+    }
+    member_offsets_.reserve(num_blocks + 1);
+    size_t pos = 0;
+    while(valid && pos < index.size()) {
+      const char* member = &index[pos];
+      size_t fixed = GZ_HEADER_SIZE + 2 + 4;
+      if(index.size() - pos < fixed) {
+        valid = false;
+        break;
+      }
+      size_t len = decodeLittleEndian(member + GZ_HEADER_SIZE + 2 + 2, 2);
+      const char* entries = member + fixed;
+      valid = member[GZ_HEADER_SIZE + 2] == 'E' && member[GZ_HEADER_SIZE + 3] == 'I' &&
+        len % sizeof(uint64_t) == 0 && index.size() - pos - fixed >= len + GZ_EMPTY_BODY_SIZE + GZ_TRAILER_SIZE;
+      for(size_t i = 0; valid && i < len; i += sizeof(uint64_t)) {
+        // -- Offsets must increase and stay in the data section, so
+        //    every block has a sensible compressed size.
+        uint64_t offset = decodeLittleEndian(entries + i, sizeof(uint64_t));
+        valid = offset < index_offset && (member_offsets_.empty() || offset > member_offsets_.back());
+        member_offsets_.push_back(offset);
+      }
+      pos += fixed + len + GZ_EMPTY_BODY_SIZE + GZ_TRAILER_SIZE;
+    }
+    if(!valid || member_offsets_.size() != num_blocks) {
+      cerr << "Corrupt index in " << filename << ": expected " << num_blocks << " blocks." << endl;
+      abort();
+    }
+    member_offsets_.push_back(index_offset);
+  }
+
+  BlockedGzipReader::~BlockedGzipReader()
+  {
+    if(fd_ >= 0)
+      close(fd_);
+  }
+
+  void BlockedGzipReader::inflateBlock(uint64_t idx, char* dest) const
+  {
+    uint64_t begin = member_offsets_[idx];
+    uint64_t end = member_offsets_[idx + 1];
+    uint64_t num = min(block_size_, total_size_ - idx * block_size_);
+    string compressed(end - begin, 0);
+    if(end < begin + GZ_HEADER_SIZE + GZ_TRAILER_SIZE || !preadAll(fd_, &compressed[0], compressed.size(), begin)) {
+      cerr << "Failed to read block " << idx << " of " << filename_ << "." << endl;
+      abort();
+    }
+    
+    if(!inflateRaw(&compressed[GZ_HEADER_SIZE], compressed.size() - GZ_HEADER_SIZE - GZ_TRAILER_SIZE, dest, num)) {
+      cerr << "Corrupt block " << idx << " in " << filename_ << "." << endl;
+      abort();
+    }
+
+    uLong crc = decodeLittleEndian(&compressed[compressed.size() - GZ_TRAILER_SIZE], 4);
+    if(crc != crc32(0L, (const Bytef*)dest, num)) {
+      cerr << "CRC mismatch in block " << idx << " of " << filename_ << "." << endl;
+      abort();
+    }
+  }
+  
+  void BlockedGzipReader::readBlocks(uint64_t offset, uint64_t len, char* dest, int num_threads, int thread_id) const
+  {
+    uint64_t first = offset / block_size_;
+    uint64_t last = (offset + len - 1) / block_size_;
+    vector<char> buf;
+    for(uint64_t i = first + thread_id; i <= last; i += num_threads) {
+      uint64_t block_begin = i * block_size_;
+      uint64_t block_end = min(block_begin + block_size_, total_size_);
+      if(block_begin >= offset && block_end <= offset + len)
+        inflateBlock(i, dest + (block_begin - offset));
+      else {
+        // Partially requested block: inflate to scratch and copy the overlap.
+        buf.resize(block_end - block_begin);
+        inflateBlock(i, &buf[0]);
+        uint64_t begin = max(block_begin, offset);
+        uint64_t end = min(block_end, offset + len);
+        memcpy(dest + (begin - offset), &buf[begin - block_begin], end - begin);
+      }
+    }
+  }
+  
+  void BlockedGzipReader::read(uint64_t offset, uint64_t len, char* dest, int num_threads) const
+  {
+    if(offset > total_size_ || len > total_size_ - offset) {
+      cerr << "Read of " << len << " bytes at " << offset << " is past the end of " << filename_
+           << ", which holds " << total_size_ << " bytes." << endl;
+      abort();
+    }
+    if(len == 0)
+      return;
+
+    if(num_threads <= 0)
+      num_threads = max<int>(1, boost::thread::hardware_concurrency());
+    uint64_t num_blocks = (offset + len - 1) / block_size_ - offset / block_size_ + 1;
+    num_threads = min<uint64_t>(num_threads, num_blocks);
+    if(num_threads == 1) {
+      readBlocks(offset, len, dest, 1, 0);
+      return;
+    }
+    
+    boost::thread_group threads;
+    for(int i = 0; i < num_threads; ++i)
+      threads.create_thread(boost::bind(&BlockedGzipReader::readBlocks, this, offset, len, dest, num_threads, i));
+    threads.join_all();
+  }
+  
+} // namespace
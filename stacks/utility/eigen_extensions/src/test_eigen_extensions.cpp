@@ -1,4 +1,11 @@
 #include <eigen_extensions/eigen_extensions.h>
+#include <eigen_extensions/mapped_matrix.h>
+#include <eigen_extensions/block_reader.h>
+#include <eigen_extensions/archive.h>
+#include <eigen_extensions/prefetcher.h>
+#include <eigen_extensions/appender.h>
+#include <eigen_extensions/async_saver.h>
+#include <timer/timer.h>
 #include <gtest/gtest.h>
 
 using namespace std;
@@ -6,6 +13,16 @@ using namespace Eigen;
 
 int size = 3;
 
+// -- Count calls to malloc so tests can check for heap allocation.
+//    Eigen and the old deserialize() buffer both go through malloc.
+extern "C" void* __libc_malloc(size_t size);
+int g_num_mallocs = 0;
+extern "C" void* malloc(size_t size)
+{
+  ++g_num_mallocs;
+  return __libc_malloc(size);
+}
+
 TEST(EigenExtensions, MatrixXd_serialization) {
   MatrixXd mat = MatrixXd::Random(size, size);
   eigen_extensions::save(mat, "matxd.eig");
@@ -62,6 +79,588 @@ TEST(EigenExtensions, Vector3i_serialization) {
   cout << mat2.transpose() << endl;
 }
 
+TEST(EigenExtensions, Version1Compatibility) {
+  MatrixXf mat = MatrixXf::Random(4, 7);
+  int bytes = sizeof(float);
+  int rows = mat.rows();
+  int cols = mat.cols();
+  std::ofstream file("v1.eig");
+  file.write((char*)&bytes, sizeof(int));
+  file.write((char*)&rows, sizeof(int));
+  file.write((char*)&cols, sizeof(int));
+  file.write((char*)mat.data(), sizeof(float) * rows * cols);
+  file.close();
+
+  MatrixXf mat2;
+  eigen_extensions::load("v1.eig", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+}
+
+TEST(EigenExtensions, Version2Header) {
+  MatrixXf mat = MatrixXf::Random(4, 7);
+  eigen_extensions::save(mat, "v2.eig");
+  std::ifstream file("v2.eig");
+  eigen_extensions::EigHeader header;
+  eigen_extensions::deserializeHeader(file, &header);
+  EXPECT_EQ(file.tellg(), eigen_extensions::EIG_HEADER_SIZE);
+  file.close();
+  EXPECT_EQ(eigen_extensions::EIG_VERSION, header.version);
+  EXPECT_EQ(eigen_extensions::EIG_FLOAT32, header.scalar_type);
+  EXPECT_FALSE(header.rowMajor());
+  EXPECT_EQ(4, header.rows);
+  EXPECT_EQ(7, header.cols);
+
+  RowVectorXd row = RowVectorXd::Random(5);
+  eigen_extensions::save(row, "v2_row.eig");
+  file.open("v2_row.eig");
+  eigen_extensions::deserializeHeader(file, &header);
+  file.close();
+  EXPECT_EQ(eigen_extensions::EIG_FLOAT64, header.scalar_type);
+  EXPECT_TRUE(header.rowMajor());
+  RowVectorXd row2;
+  eigen_extensions::load("v2_row.eig", &row2);
+  EXPECT_TRUE(row.isApprox(row2));
+
+  // -- Sizes past 2^31 elements do not overflow.
+  header.bytes = sizeof(double);
+  header.rows = 100000;
+  header.cols = 100000;
+  EXPECT_EQ((uint64_t)100000 * 100000 * sizeof(double), header.payloadSize());
+}
+
+TEST(EigenExtensions, MappedMatrix) {
+  MatrixXd mat = MatrixXd::Random(100, 37);
+  eigen_extensions::save(mat, "mapped.eig");
+
+  eigen_extensions::MappedMatrix<double, Dynamic, Dynamic> mapped("mapped.eig");
+  EXPECT_EQ(0, (size_t)mapped.matrix().data() % 64);
+  EXPECT_TRUE(mat.isApprox(mapped.matrix()));
+
+  // Copies keep the mapping alive after the original goes away.
+  eigen_extensions::MappedMatrix<double, Dynamic, Dynamic>* tmp;
+  tmp = new eigen_extensions::MappedMatrix<double, Dynamic, Dynamic>(eigen_extensions::mapMatrix<MatrixXd>("mapped.eig"));
+  eigen_extensions::MappedMatrix<double, Dynamic, Dynamic> copy(*tmp);
+  delete tmp;
+  EXPECT_TRUE(mat.col(13).isApprox(copy.matrix().col(13)));
+
+  Matrix4f fixed = Matrix4f::Random();
+  eigen_extensions::save(fixed, "mapped4f.eig");
+  EXPECT_TRUE(fixed.isApprox(eigen_extensions::mapMatrix<Matrix4f>("mapped4f.eig").matrix()));
+}
+
+TEST(EigenExtensions, DeserializationAllocations)
+{
+  int reps = 100;
+  MatrixXf mat = MatrixXf::Random(640, 480);
+  std::ofstream ofile("allocations.eig");
+  for(int i = 0; i < reps; ++i)
+    eigen_extensions::serialize(mat, ofile);
+  ofile.close();
+
+  // -- The first deserialization allocates the destination.
+  std::ifstream ifile("allocations.eig");
+  MatrixXf mat2;
+  eigen_extensions::deserialize(ifile, &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+
+  // -- The rest should reuse it.
+  HighResTimer hrt;
+  int num_mallocs = g_num_mallocs;
+  hrt.start();
+  for(int i = 1; i < reps; ++i)
+    eigen_extensions::deserialize(ifile, &mat2);
+  hrt.stop();
+  num_mallocs = g_num_mallocs - num_mallocs;
+  ifile.close();
+  
+  cout << "Deserialized " << reps - 1 << " " << mat.rows() << "x" << mat.cols() << " matrices with "
+       << num_mallocs << " mallocs, " << hrt.getMilliseconds() / (double)(reps - 1) << " ms each." << endl;
+  EXPECT_EQ(0, num_mallocs);
+  EXPECT_TRUE(mat.isApprox(mat2));
+}
+
+TEST(EigenExtensions, BlockReader)
+{
+  MatrixXd mat = MatrixXd::Random(50, 1003);
+  eigen_extensions::save(mat, "blocks.eig");
+  eigen_extensions::save(mat, "blocks.eig.gz");
+
+  vector<string> filenames;
+  filenames.push_back("blocks.eig");
+  filenames.push_back("blocks.eig.gz");
+  for(size_t i = 0; i < filenames.size(); ++i) {
+    eigen_extensions::EigBlockReader<double> reader(filenames[i], 100);
+    EXPECT_EQ(mat.rows(), reader.rows());
+    EXPECT_EQ(mat.cols(), reader.cols());
+
+    MatrixXd block;
+    int num_blocks = 0;
+    while(true) {
+      int64_t begin = reader.position();
+      if(!reader.next(&block))
+        break;
+      EXPECT_TRUE(block.isApprox(mat.middleCols(begin, block.cols())));
+      ++num_blocks;
+    }
+    EXPECT_EQ(11, num_blocks);
+    EXPECT_EQ(mat.cols(), reader.position());
+  }
+}
+
+TEST(EigenExtensions, BlockReaderDecodes)
+{
+  // -- Encoded, shuffled, converted and codec files come out as load() gives them.
+  MatrixXf mat = MatrixXf::Random(50, 1003);
+  vector<string> filenames;
+  eigen_extensions::SaveOptions opts;
+  opts.encoding = eigen_extensions::EIG_FLOAT16;
+  opts.shuffle = true;
+  eigen_extensions::save(mat, "blocks_encoded.eig", opts);
+  filenames.push_back("blocks_encoded.eig");
+  eigen_extensions::save(mat, "blocks_encoded.eig.gz", opts);
+  filenames.push_back("blocks_encoded.eig.gz");
+  eigen_extensions::save(mat, "blocks_float.eig");
+  filenames.push_back("blocks_float.eig");
+  if(eigen_extensions::findCodec(eigen_extensions::EIG_CODEC_ZSTD)) {
+    eigen_extensions::save(mat, "blocks.eig.zst", opts);
+    filenames.push_back("blocks.eig.zst");
+  }
+  if(eigen_extensions::findCodec(eigen_extensions::EIG_CODEC_LZ4)) {
+    eigen_extensions::save(mat, "blocks.eig.lz4");
+    filenames.push_back("blocks.eig.lz4");
+  }
+
+  for(size_t i = 0; i < filenames.size(); ++i) {
+    MatrixXd expected;
+    eigen_extensions::load(filenames[i], &expected);
+    eigen_extensions::EigBlockReader<double> reader(filenames[i], 100);
+    MatrixXd block;
+    int64_t begin = reader.position();
+    while(reader.next(&block)) {
+      EXPECT_TRUE(block == expected.middleCols(begin, block.cols())) << filenames[i];
+      begin = reader.position();
+    }
+    EXPECT_EQ(mat.cols(), reader.position());
+  }
+}
+
+TEST(EigenExtensions, BlockReaderRowMajor)
+{
+  typedef Matrix<float, Dynamic, Dynamic, RowMajor> RowMajorXf;
+  RowMajorXf mat = RowMajorXf::Random(1003, 50);
+  eigen_extensions::save(mat, "blocks_row_major.eig");
+
+  eigen_extensions::EigBlockReader<float> reader("blocks_row_major.eig", 100);
+  EXPECT_TRUE(reader.rowMajor());
+  MatrixXf block;
+  int num_blocks = 0;
+  while(true) {
+    int64_t begin = reader.position();
+    if(!reader.next(&block))
+      break;
+    EXPECT_EQ(mat.cols(), block.cols());
+    EXPECT_TRUE(block == mat.middleRows(begin, block.rows()));
+    ++num_blocks;
+  }
+  EXPECT_EQ(11, num_blocks);
+  EXPECT_EQ(mat.rows(), reader.position());
+}
+
+TEST(EigenExtensions, ParallelGzip)
+{
+  // Quantized values so that the data is compressible, like real features.
+  MatrixXd mat = (MatrixXd::Random(500, 1000) * 100).array().round().matrix();
+  double mb = mat.size() * sizeof(double) / 1e6;
+  MatrixXd mat2;
+  
+  HighResTimer hrt;
+  hrt.start();
+  ogzstream file("pgz_serial.eig.gz");
+  eigen_extensions::serialize(mat, file);
+  file.close();
+  hrt.stop();
+  cout << "ogzstream: " << mb / hrt.getSeconds() << " MB/s" << endl;
+  eigen_extensions::load("pgz_serial.eig.gz", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+
+  int num_threads[] = {1, 2, 0};
+  for(int i = 0; i < 3; ++i) {
+    eigen_extensions::SaveOptions opts;
+    opts.num_threads = num_threads[i];
+    hrt.reset();
+    hrt.start();
+    eigen_extensions::save(mat, "pgz.eig.gz", opts);
+    hrt.stop();
+    cout << "ParallelGzipOstream with num_threads = " << num_threads[i] << ": " << mb / hrt.getSeconds() << " MB/s" << endl;
+
+    mat2.setZero();
+    eigen_extensions::load("pgz.eig.gz", &mat2);
+    EXPECT_TRUE(mat.isApprox(mat2));
+  }
+
+  // Empty payloads still produce a valid stream.
+  MatrixXd empty;
+  eigen_extensions::save(empty, "pgz_empty.eig.gz");
+  eigen_extensions::load("pgz_empty.eig.gz", &mat2);
+  EXPECT_EQ(0, mat2.size());
+}
+
+TEST(EigenExtensions, BlockedGzip)
+{
+  MatrixXf mat = (MatrixXf::Random(300, 1000) * 100).array().round().matrix();
+  eigen_extensions::SaveOptions opts;
+  opts.blocked_gzip = true;
+  eigen_extensions::save(mat, "blocked.eig.gz", opts);
+  EXPECT_TRUE(eigen_extensions::isBlockedGzip("blocked.eig.gz"));
+
+  // -- Parallel inflate via load().
+  MatrixXf mat2;
+  eigen_extensions::load("blocked.eig.gz", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+
+  // -- Plain gzip readers see a normal multi-member stream.
+  igzstream file("blocked.eig.gz");
+  eigen_extensions::deserialize(file, &mat2);
+  file.close();
+  EXPECT_TRUE(mat.isApprox(mat2));
+  
+  // -- Random access to a column range.
+  eigen_extensions::loadCols("blocked.eig.gz", 457, 613, &mat2);
+  EXPECT_TRUE(mat.middleCols(457, 613 - 457).isApprox(mat2));
+  eigen_extensions::loadCols("blocked.eig.gz", 999, 1000, &mat2);
+  EXPECT_TRUE(mat.col(999).isApprox(mat2));
+}
+
+TEST(EigenExtensions, LoadCols)
+{
+  MatrixXf mat = MatrixXf::Random(50, 300);
+  vector<int64_t> indices;
+  indices.push_back(7);
+  indices.push_back(8);
+  indices.push_back(9);
+  indices.push_back(250);
+  indices.push_back(3);
+  indices.push_back(8);
+  indices.push_back(299);
+  MatrixXf expected(mat.rows(), indices.size());
+  for(size_t i = 0; i < indices.size(); ++i)
+    expected.col(i) = mat.col(indices[i]);
+  
+  string filenames[] = {"cols.eig", "cols.eig.gz", "cols_blocked.eig.gz"};
+  for(int i = 0; i < 3; ++i) {
+    eigen_extensions::SaveOptions opts;
+    opts.blocked_gzip = (i == 2);
+    eigen_extensions::save(mat, filenames[i], opts);
+    MatrixXf mat2;
+    eigen_extensions::loadCols(filenames[i], 100, 180, &mat2);
+    EXPECT_TRUE(mat.middleCols(100, 80) == mat2);
+    eigen_extensions::loadCols(filenames[i], indices, &mat2);
+    EXPECT_TRUE(expected == mat2);
+    eigen_extensions::loadCols(filenames[i], 5, 5, &mat2);
+    EXPECT_EQ(0, mat2.cols());
+
+    // -- Encoded files decode only the requested columns.
+    opts.encoding = eigen_extensions::EIG_AFFINE_INT8;
+    eigen_extensions::save(mat, filenames[i], opts);
+    eigen_extensions::loadCols(filenames[i], indices, &mat2);
+    EXPECT_LT((expected - mat2).cwiseAbs().maxCoeff(), 1.0 / 255);
+  }
+}
+
+TEST(EigenExtensions, CrossPrecision)
+{
+  MatrixXd dmat = MatrixXd::Random(40, 70) * 100;
+  MatrixXf expected = dmat.cast<float>();
+  string filenames[] = {"cross.eig", "cross.eig.gz", "cross_blocked.eig.gz"};
+  for(int i = 0; i < 3; ++i) {
+    eigen_extensions::SaveOptions opts;
+    opts.blocked_gzip = (i == 2);
+    eigen_extensions::save(dmat, filenames[i], opts);
+    MatrixXf mat;
+    eigen_extensions::load(filenames[i], &mat);
+    EXPECT_TRUE(expected == mat);
+    eigen_extensions::loadCols(filenames[i], 10, 20, &mat);
+    EXPECT_TRUE(expected.middleCols(10, 10) == mat);
+
+    MatrixXi imat;
+    eigen_extensions::load(filenames[i], &imat);
+    EXPECT_TRUE(dmat.cast<int>() == imat);
+    eigen_extensions::save(imat, filenames[i], opts);
+    MatrixXd dmat2;
+    eigen_extensions::load(filenames[i], &dmat2);
+    EXPECT_TRUE(imat.cast<double>() == dmat2);
+  }
+
+  // -- Inputs larger than one conversion chunk.
+  VectorXf vec = VectorXf::Random(eigen_extensions::CONVERSION_CHUNK_SIZE / 4 + 1000);
+  eigen_extensions::save(vec, "cross.eig");
+  VectorXd dvec;
+  eigen_extensions::load("cross.eig", &dvec);
+  EXPECT_TRUE(vec.cast<double>() == dvec);
+}
+
+TEST(EigenExtensions, StorageOrder)
+{
+  typedef Matrix<float, Dynamic, Dynamic, RowMajor> MatrixXfr;
+  typedef Matrix<double, Dynamic, Dynamic, RowMajor> MatrixXdr;
+  
+  // -- Large enough for several panels and threads.
+  MatrixXfr rmat = MatrixXfr::Random(1500, 1000);
+  MatrixXf cmat = rmat;
+  string filenames[] = {"order.eig", "order.eig.gz", "order_blocked.eig.gz"};
+  for(int i = 0; i < 3; ++i) {
+    eigen_extensions::SaveOptions opts;
+    opts.blocked_gzip = (i == 2);
+    opts.level = 1;
+    eigen_extensions::save(rmat, filenames[i], opts);
+    MatrixXf cmat2;
+    eigen_extensions::load(filenames[i], &cmat2);
+    EXPECT_TRUE(cmat == cmat2);
+    MatrixXfr rmat2;
+    eigen_extensions::load(filenames[i], &rmat2);
+    EXPECT_TRUE(rmat == rmat2);
+    MatrixXd dmat;
+    eigen_extensions::load(filenames[i], &dmat);
+    EXPECT_TRUE(cmat.cast<double>() == dmat);
+
+    eigen_extensions::save(cmat, filenames[i], opts);
+    MatrixXdr rdmat;
+    eigen_extensions::load(filenames[i], &rdmat);
+    EXPECT_TRUE(rmat.cast<double>() == rdmat);
+    eigen_extensions::loadCols(filenames[i], 10, 20, &rmat2);
+    EXPECT_TRUE(rmat.middleCols(10, 10) == rmat2);
+  }
+
+  // -- Encoded row-major matrices are quantized row by row.
+  eigen_extensions::SaveOptions opts;
+  opts.encoding = eigen_extensions::EIG_AFFINE_INT8;
+  MatrixXfr small = rmat.topLeftCorner(30, 20);
+  eigen_extensions::save(small, "order.eig", opts);
+  MatrixXf small2;
+  eigen_extensions::load("order.eig", &small2);
+  EXPECT_LT((MatrixXf(small) - small2).cwiseAbs().maxCoeff(), 1.0 / 255);
+}
+
+TEST(EigenExtensions, Appender)
+{
+  boost::filesystem::remove("appended.eig");
+  MatrixXf mat = MatrixXf::Random(20, 100);
+  MatrixXf mat2;
+  {
+    // Small buffer so that some appends flush on their own.
+    eigen_extensions::EigAppender<float> appender("appended.eig", 20, 1000);
+    EXPECT_TRUE(appender.append(mat.col(0)));
+    EXPECT_TRUE(appender.append(mat.middleCols(1, 29)));
+    EXPECT_EQ(30, appender.cols());
+
+    // -- Readers see everything flushed so far.
+    EXPECT_TRUE(appender.flush());
+    eigen_extensions::load("appended.eig", &mat2);
+    EXPECT_TRUE(mat.leftCols(30) == mat2);
+    appender.append(mat.middleCols(30, 10).cast<double>());
+  }
+  eigen_extensions::load("appended.eig", &mat2);
+  EXPECT_TRUE(mat.leftCols(40) == mat2);
+
+  // -- Reopening continues where the file left off.
+  eigen_extensions::EigAppender<float> appender("appended.eig", 20);
+  EXPECT_EQ(40, appender.cols());
+  EXPECT_TRUE(appender.append(mat.rightCols(60)));
+  EXPECT_TRUE(appender.close());
+  eigen_extensions::load("appended.eig", &mat2);
+  EXPECT_TRUE(mat == mat2);
+  EXPECT_EQ(64 + mat.size() * sizeof(float), boost::filesystem::file_size("appended.eig"));
+}
+
+TEST(EigenExtensions, FixedSize)
+{
+  Matrix4f pose = Matrix4f::Random();
+  Vector3i point = Vector3i::Random();
+  vector<Vector4f, aligned_allocator<Vector4f> > points(1000);
+  for(size_t i = 0; i < points.size(); ++i)
+    points[i] = Vector4f::Random();
+  vector<Matrix3d> rotations(10, Matrix3d::Random());
+
+  // -- serialize() keeps its header; serializeFixed() writes bare coefficients.
+  ostringstream with_header;
+  eigen_extensions::serialize(pose, with_header);
+  EXPECT_EQ(64 + sizeof(Matrix4f), with_header.str().size());
+  ostringstream oss;
+  eigen_extensions::serializeFixed(pose, oss);
+  EXPECT_EQ(sizeof(Matrix4f), oss.str().size());
+  eigen_extensions::serializeFixed(point, oss);
+  eigen_extensions::serialize(points, oss);
+  eigen_extensions::serialize(rotations, oss);
+  EXPECT_EQ(sizeof(Matrix4f) + sizeof(Vector3i) + 2 * 12 + sizeof(Vector4f) * 1000 + sizeof(Matrix3d) * 10,
+            oss.str().size());
+
+  istringstream iss(oss.str());
+  Matrix4f pose2;
+  Vector3i point2;
+  vector<Vector4f, aligned_allocator<Vector4f> > points2;
+  vector<Matrix3d> rotations2;
+  eigen_extensions::deserializeFixed(iss, &pose2);
+  eigen_extensions::deserializeFixed(iss, &point2);
+  eigen_extensions::deserialize(iss, &points2);
+  eigen_extensions::deserialize(iss, &rotations2);
+  EXPECT_TRUE(pose == pose2);
+  EXPECT_TRUE(point == point2);
+  ASSERT_EQ(points.size(), points2.size());
+  for(size_t i = 0; i < points.size(); ++i)
+    EXPECT_TRUE(points[i] == points2[i]);
+  ASSERT_EQ(rotations.size(), rotations2.size());
+  EXPECT_TRUE(rotations[9] == rotations2[9]);
+
+  // -- Truncated streams and mismatched element sizes fail cleanly.
+  ostringstream vec_oss;
+  eigen_extensions::serialize(points, vec_oss);
+  istringstream truncated(vec_oss.str().substr(0, 1000));
+  eigen_extensions::deserialize(truncated, &points2);
+  EXPECT_TRUE(truncated.fail());
+  EXPECT_EQ(0, (int)points2.size());
+  istringstream mismatched(vec_oss.str());
+  eigen_extensions::deserialize(mismatched, &rotations2);
+  EXPECT_TRUE(mismatched.fail());
+  EXPECT_EQ(0, (int)rotations2.size());
+  
+  // -- Files keep their header.
+  eigen_extensions::save(pose, "fixed.eig");
+  EXPECT_EQ(64 + sizeof(Matrix4f), boost::filesystem::file_size("fixed.eig"));
+  eigen_extensions::load("fixed.eig", &pose2);
+  EXPECT_TRUE(pose == pose2);
+}
+
+TEST(EigenExtensions, Archive)
+{
+  MatrixXf w1 = MatrixXf::Random(30, 20);
+  VectorXd b1 = VectorXd::Random(30);
+  MatrixXf w2 = MatrixXf::Zero(100, 100);
+  SparseMatrix<double> sp(5, 3);
+  sp.insert(1, 0) = 2;
+  sp.insert(4, 2) = 3;
+  sp.finalize();
+  
+  eigen_extensions::ArchiveWriter writer("model.eiga");
+  writer.add("W1", w1);
+  writer.add("b1", b1);
+  writer.add("W2", w2, true);
+  writer.add("sparse", sp, true);
+  writer.close();
+
+  eigen_extensions::ArchiveReader reader("model.eiga");
+  EXPECT_EQ(4, reader.names().size());
+  EXPECT_TRUE(reader.contains("W1"));
+  EXPECT_FALSE(reader.contains("W3"));
+  EXPECT_EQ(0, reader.entry("b1").offset % 64);
+  EXPECT_LT(reader.entry("W2").stored_size, reader.entry("W2").size);
+  
+  // -- Out of order, repeated, and mixed compressed / uncompressed.
+  MatrixXf w2b;
+  reader.load("W2", &w2b);
+  EXPECT_TRUE(w2 == w2b);
+  VectorXd b1b;
+  reader.load("b1", &b1b);
+  EXPECT_TRUE(b1.isApprox(b1b));
+  MatrixXf w1b;
+  reader.load("W1", &w1b);
+  EXPECT_TRUE(w1.isApprox(w1b));
+  SparseMatrix<double> spb;
+  reader.load("sparse", &spb);
+  EXPECT_TRUE(sp.isApprox(spb));
+  reader.load("W1", &w1b);
+  EXPECT_TRUE(w1.isApprox(w1b));
+}
+
+TEST(EigenExtensions, Encodings)
+{
+  // -- Conversion kernels, including the SIMD bodies and scalar tails.
+  float vals[] = {0.0f, -0.0f, 1.0f, -2.5f, 65504.0f, 1e-7f, 3.14159265f, 1e6f, -1e-3f, 0.1f,
+                  0.5f, 2048.0f, 6.1e-5f, -7.0f, 100.0f, 0.333333f, 12345.678f};
+  int num = sizeof(vals) / sizeof(float);
+  vector<uint16_t> codes(num);
+  vector<float> decoded(num);
+  eigen_extensions::encodeFloat16(vals, num, &codes[0]);
+  eigen_extensions::decodeFloat16(&codes[0], num, &decoded[0]);
+  EXPECT_EQ(0x3c00, codes[2]);
+  EXPECT_EQ(0x7bff, codes[4]);
+  EXPECT_TRUE(isinf(decoded[7]));
+  for(int i = 0; i < num; ++i) {
+    if(i != 7 && fabs(vals[i]) > 6.1e-5f) {
+      EXPECT_NEAR(vals[i], decoded[i], fabs(vals[i]) / 1024);
+    }
+  }
+  eigen_extensions::encodeBfloat16(vals, num, &codes[0]);
+  eigen_extensions::decodeBfloat16(&codes[0], num, &decoded[0]);
+  for(int i = 0; i < num; ++i)
+    EXPECT_NEAR(vals[i], decoded[i], fabs(vals[i]) / 128);
+
+  // -- Round trips through save() and load().
+  MatrixXf mat = MatrixXf::Random(100, 37);
+  mat.col(3).setConstant(42);
+  int encodings[] = {eigen_extensions::EIG_FLOAT16, eigen_extensions::EIG_BFLOAT16, eigen_extensions::EIG_AFFINE_INT8};
+  float tolerances[] = {1e-3, 1e-2, 1.0 / 255};
+  string filenames[] = {"encoded.eig", "encoded.eig.gz"};
+  for(int i = 0; i < 3; ++i) {
+    eigen_extensions::SaveOptions opts;
+    opts.encoding = encodings[i];
+    for(int j = 0; j < 2; ++j) {
+      opts.blocked_gzip = (i == 2);
+      eigen_extensions::save(mat, filenames[j], opts);
+      MatrixXf mat2;
+      eigen_extensions::load(filenames[j], &mat2);
+      ASSERT_EQ(mat.rows(), mat2.rows());
+      ASSERT_EQ(mat.cols(), mat2.cols());
+      EXPECT_LT((mat - mat2).cwiseAbs().maxCoeff(), tolerances[i]);
+      EXPECT_FLOAT_EQ(42, mat2(50, 3));
+    }
+
+    // -- Double matrices work too, in either direction.
+    MatrixXd dmat = mat.cast<double>();
+    eigen_extensions::save(dmat, "encoded.eig", opts);
+    MatrixXf mat3;
+    eigen_extensions::load("encoded.eig", &mat3);
+    EXPECT_LT((mat - mat3).cwiseAbs().maxCoeff(), tolerances[i]);
+    MatrixXd dmat2;
+    eigen_extensions::save(mat, "encoded.eig", opts);
+    eigen_extensions::load("encoded.eig", &dmat2);
+    EXPECT_LT((mat.cast<double>() - dmat2).cwiseAbs().maxCoeff(), tolerances[i]);
+  }
+  
+  eigen_extensions::SaveOptions opts;
+  opts.encoding = eigen_extensions::EIG_AFFINE_INT8;
+  eigen_extensions::save(mat, "encoded.eig", opts);
+  EXPECT_EQ(64 + mat.cols() * (8 + mat.rows()), boost::filesystem::file_size("encoded.eig"));
+}
+
+TEST(EigenExtensions, Prefetcher)
+{
+  vector<MatrixXf> mats;
+  vector<string> filenames;
+  for(int i = 0; i < 10; ++i) {
+    mats.push_back(MatrixXf::Random(100, 50 + i));
+    ostringstream oss;
+    oss << "prefetch" << i << (i % 2 ? ".eig" : ".eig.gz");
+    filenames.push_back(oss.str());
+    eigen_extensions::save(mats.back(), filenames.back());
+  }
+
+  eigen_extensions::EigPrefetcher<MatrixXf> prefetcher(filenames, 3, 4);
+  MatrixXf mat;
+  int num = 0;
+  while(prefetcher.next(&mat)) {
+    EXPECT_TRUE(mats[num].isApprox(mat));
+    ++num;
+  }
+  EXPECT_EQ(10, num);
+
+  // -- Destroying a prefetcher before it finishes stops the workers.
+  {
+    eigen_extensions::EigPrefetcher<MatrixXf> partial(filenames, 2, 2);
+    partial.next(&mat);
+    EXPECT_TRUE(mats[0].isApprox(mat));
+  }
+}
+
 TEST(EigenExtensions, MatrixXd_serialization_ascii) {
   MatrixXd mat = MatrixXd::Random(5, 20);
   eigen_extensions::saveASCII(mat, "matxd.eig.txt");
@@ -85,6 +684,97 @@ TEST(EigenExtensions, Vector3i_serialization_ascii) {
   cout << mat2.transpose() << endl;
 }
 
+TEST(EigenExtensions, ASCIIRoundTrip) {
+  MatrixXd matd = MatrixXd::Random(7, 11) * 1e5;
+  matd(0, 0) = 0.1;
+  matd(0, 1) = 1e-300;
+  eigen_extensions::saveASCII(matd, "roundtrip_d.eig.txt");
+  MatrixXd matd2;
+  eigen_extensions::loadASCII("roundtrip_d.eig.txt", &matd2);
+  EXPECT_TRUE(matd == matd2);
+
+  // -- Values print with the fewest digits that round-trip.
+  char buf[eigen_extensions::ASCII_SCALAR_BUFFER_SIZE];
+  eigen_extensions::formatASCIIScalar(0.1, buf);
+  EXPECT_STREQ("0.1", buf);
+  eigen_extensions::formatASCIIScalar(0.1 + 0.2, buf);
+  EXPECT_STREQ("0.30000000000000004", buf);
+  eigen_extensions::formatASCIIScalar(1.0 / 3, buf);
+  EXPECT_STREQ("0.3333333333333333", buf);
+  eigen_extensions::formatASCIIScalar(123456.789, buf);
+  EXPECT_STREQ("123456.789", buf);
+  eigen_extensions::formatASCIIScalar(0.1f, buf);
+  EXPECT_STREQ("0.1", buf);
+  eigen_extensions::formatASCIIScalar(1.0f / 3, buf);
+  EXPECT_STREQ("0.33333334", buf);
+  eigen_extensions::formatASCIIScalar(5e-324, buf);
+  EXPECT_STREQ("5e-324", buf);
+
+  MatrixXf matf = MatrixXf::Random(11, 7);
+  eigen_extensions::saveASCII(matf, "roundtrip_f.eig.txt");
+  MatrixXf matf2;
+  eigen_extensions::loadASCII("roundtrip_f.eig.txt", &matf2);
+  EXPECT_TRUE(matf == matf2);
+
+  // -- Integers above 2^53 do not survive a trip through double.
+  Matrix<int64_t, 2, 2> mati;
+  mati << (1LL << 62) + 1, -(1LL << 62) - 1, 3, -4;
+  eigen_extensions::saveASCII(mati, "roundtrip_i.eig.txt");
+  Matrix<int64_t, 2, 2> mati2;
+  eigen_extensions::loadASCII("roundtrip_i.eig.txt", &mati2);
+  EXPECT_TRUE(mati == mati2);
+
+  Matrix<uint64_t, Dynamic, 1> matu(2);
+  matu << 18446744073709551615ULL, 9007199254740993ULL;
+  eigen_extensions::saveASCII(matu, "roundtrip_u.eig.txt");
+  Matrix<uint64_t, Dynamic, 1> matu2;
+  eigen_extensions::loadASCII("roundtrip_u.eig.txt", &matu2);
+  EXPECT_TRUE(matu == matu2);
+
+  // -- Other scalar types go through operator<< and operator>>.
+  MatrixXcd matc = MatrixXcd::Random(3, 4);
+  eigen_extensions::saveASCII(matc, "roundtrip_c.eig.txt");
+  MatrixXcd matc2;
+  eigen_extensions::loadASCII("roundtrip_c.eig.txt", &matc2);
+  EXPECT_TRUE(matc == matc2);
+}
+
+TEST(EigenExtensions, ASCIIEigenFormatted) {
+  // Files written with Eigen's operator<< have padded columns.
+  MatrixXd mat = MatrixXd::Random(5, 8);
+  std::ofstream file("formatted.eig.txt");
+  file.precision(16);
+  file << "% " << mat.rows() << " " << mat.cols() << endl;
+  file << mat << endl;
+  file.close();
+
+  MatrixXd mat2;
+  eigen_extensions::loadASCII("formatted.eig.txt", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+}
+
+TEST(EigenExtensions, ASCIIParallel) {
+  MatrixXd mat = MatrixXd::Random(500, 300);
+  double mb = 0;
+  HighResTimer hrt;
+  hrt.start();
+  eigen_extensions::saveASCII(mat, "parallel.eig.txt");
+  hrt.stop();
+  mb = boost::filesystem::file_size("parallel.eig.txt") / 1e6;
+  cout << "saveASCII: " << mb / hrt.getSeconds() << " MB/s" << endl;
+
+  std::ifstream file("parallel.eig.txt");
+  std::string buf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  file.close();
+  MatrixXd mat2;
+  hrt.reset();
+  hrt.start();
+  eigen_extensions::deserializeASCII(buf, &mat2, 4);
+  hrt.stop();
+  cout << "deserializeASCII with 4 threads: " << mb / hrt.getSeconds() << " MB/s" << endl;
+  EXPECT_TRUE(mat == mat2);
+}
+
 TEST(EigenExtensions, Compression)
 {
   MatrixXd mat = MatrixXd::Identity(1000, 1000);
@@ -98,6 +788,177 @@ TEST(EigenExtensions, Compression)
   EXPECT_TRUE(mat.isApprox(mat2));
 }
 
+TEST(EigenExtensions, Codecs)
+{
+  // -- Codecs found at build time must be registered.
+#ifdef EIGEN_EXTENSIONS_HAVE_LZ4
+  EXPECT_TRUE(eigen_extensions::findCodec(eigen_extensions::EIG_CODEC_LZ4) != NULL);
+#endif
+#ifdef EIGEN_EXTENSIONS_HAVE_ZSTD
+  EXPECT_TRUE(eigen_extensions::findCodec(eigen_extensions::EIG_CODEC_ZSTD) != NULL);
+#endif
+
+  // -- Large enough for several batches of 1MB blocks.  The random
+  //    half of the matrix does not compress and is stored raw.
+  MatrixXf mat = MatrixXf::Zero(1000, 3000);
+  mat.leftCols(1500).setRandom();
+  SparseMatrix<float> sparse = mat.sparseView();
+  sparse = sparse.leftCols(100);
+  
+  string filenames[] = {"codec.eig.lz4", "codec.eig.zst", "codec_opts.eig"};
+  int codecs[] = {eigen_extensions::EIG_CODEC_LZ4, eigen_extensions::EIG_CODEC_ZSTD,
+                  eigen_extensions::EIG_CODEC_ZSTD};
+  for(int i = 0; i < 3; ++i) {
+    if(!eigen_extensions::findCodec(codecs[i])) {
+      cout << "Codec " << codecs[i] << " not built; skipping " << filenames[i] << endl;
+      continue;
+    }
+    eigen_extensions::SaveOptions opts;
+    if(i == 2)
+      opts.codec = codecs[i];
+    eigen_extensions::save(mat, filenames[i], opts);
+    EXPECT_TRUE(eigen_extensions::isCodecFile(filenames[i]));
+    EXPECT_LT(boost::filesystem::file_size(filenames[i]), sizeof(float) * mat.size() * 3 / 4);
+    MatrixXf mat2;
+    eigen_extensions::load(filenames[i], &mat2);
+    EXPECT_TRUE(mat == mat2);
+    eigen_extensions::loadCols(filenames[i], 1400, 1600, &mat2);
+    EXPECT_TRUE(mat.middleCols(1400, 200) == mat2);
+
+    opts.level = 9;
+    eigen_extensions::save(sparse, filenames[i], opts);
+    SparseMatrix<float> sparse2;
+    eigen_extensions::load(filenames[i], &sparse2);
+    EXPECT_TRUE(sparse.isApprox(sparse2));
+
+    // -- load() would read a codec stream named .gz as gzip.
+    opts.codec = codecs[i];
+    EXPECT_FALSE(eigen_extensions::save(mat, "codec.eig.gz", opts));
+    EXPECT_FALSE(eigen_extensions::save(sparse, "codec.eig.gz", opts));
+  }
+}
+
+TEST(EigenExtensions, DenseShuffle)
+{
+  // -- Smooth, feature-like values with widths that exercise the SIMD
+  //    path and its scalar tail.
+  MatrixXf mat(1003, 200);
+  for(int j = 0; j < mat.cols(); ++j)
+    for(int i = 0; i < mat.rows(); ++i)
+      mat(i, j) = sin(0.001 * i * (j + 1)) * 100;
+
+  eigen_extensions::save(mat, "unshuffled.eig.gz");
+  eigen_extensions::SaveOptions opts;
+  opts.shuffle = true;
+  eigen_extensions::save(mat, "shuffled.eig.gz", opts);
+  cout << "Unshuffled .eig.gz: " << boost::filesystem::file_size("unshuffled.eig.gz") << " bytes." << endl;
+  cout << "Shuffled .eig.gz: " << boost::filesystem::file_size("shuffled.eig.gz") << " bytes." << endl;
+  EXPECT_LT(boost::filesystem::file_size("shuffled.eig.gz"), boost::filesystem::file_size("unshuffled.eig.gz"));
+
+  MatrixXf mat2;
+  eigen_extensions::load("shuffled.eig.gz", &mat2);
+  EXPECT_TRUE(mat == mat2);
+  eigen_extensions::loadCols("shuffled.eig.gz", 17, 40, &mat2);
+  EXPECT_TRUE(mat.middleCols(17, 23) == mat2);
+  MatrixXd dmat;
+  eigen_extensions::load("shuffled.eig.gz", &dmat);
+  EXPECT_TRUE(mat.cast<double>() == dmat);
+
+  // -- Row-major, blocked, and encoded files.
+  Matrix<float, Dynamic, Dynamic, RowMajor> rmat = mat;
+  opts.blocked_gzip = true;
+  eigen_extensions::save(rmat, "shuffled_blocked.eig.gz", opts);
+  eigen_extensions::load("shuffled_blocked.eig.gz", &mat2);
+  EXPECT_TRUE(mat == mat2);
+  opts.encoding = eigen_extensions::EIG_FLOAT16;
+  eigen_extensions::save(mat, "shuffled.eig", opts);
+  eigen_extensions::load("shuffled.eig", &mat2);
+  EXPECT_LT((mat - mat2).cwiseAbs().maxCoeff(), 0.1);
+}
+
+TEST(EigenExtensions, DirectIO)
+{
+  // -- Large enough for several staging buffers plus a partial one.
+  MatrixXf mat = MatrixXf::Random(1001, 5000);
+  SparseMatrix<double> sparse = MatrixXd::Random(300, 200).sparseView(0.5, 1);
+  for(int i = 0; i < 4; ++i) {
+    eigen_extensions::SaveOptions opts;
+    opts.direct_io = (i & 1);
+    opts.preallocate = (i & 2);
+    eigen_extensions::save(mat, "direct.eig", opts);
+    EXPECT_EQ(64 + sizeof(float) * mat.size(), boost::filesystem::file_size("direct.eig"));
+    MatrixXf mat2;
+    eigen_extensions::load("direct.eig", &mat2);
+    EXPECT_TRUE(mat == mat2);
+
+    eigen_extensions::save(sparse, "direct_sparse.eig", opts);
+    SparseMatrix<double> sparse2;
+    eigen_extensions::load("direct_sparse.eig", &sparse2);
+    EXPECT_TRUE(sparse.isApprox(sparse2));
+  }
+}
+
+TEST(EigenExtensions, AsyncSave)
+{
+  MatrixXf mat = MatrixXf::Random(100, 200);
+  SparseMatrix<double> sparse = MatrixXd::Random(300, 200).sparseView(0.5, 1);
+
+  // -- Copies leave the caller's matrices alone.
+  boost::unique_future<void> dense_future = eigen_extensions::saveAsync(mat, "async.eig");
+  boost::unique_future<void> sparse_future = eigen_extensions::saveAsync(sparse, "async_sparse.eig.gz");
+  dense_future.get();
+  sparse_future.get();
+  MatrixXf mat2;
+  eigen_extensions::load("async.eig", &mat2);
+  EXPECT_TRUE(mat == mat2);
+  SparseMatrix<double> sparse2;
+  eigen_extensions::load("async_sparse.eig.gz", &sparse2);
+  EXPECT_TRUE(sparse.isApprox(sparse2));
+
+  // -- Passing a pointer hands the contents over.
+  eigen_extensions::saveAsync(&mat2, "async_swapped.eig").get();
+  EXPECT_EQ(0, mat2.size());
+  eigen_extensions::load("async_swapped.eig", &mat2);
+  EXPECT_TRUE(mat == mat2);
+
+  // -- A budget smaller than one matrix still lets every save through, one at a time.
+  eigen_extensions::AsyncSaver saver(1024, 2);
+  vector< boost::shared_ptr< boost::unique_future<void> > > futures;
+  for(int i = 0; i < 8; ++i) {
+    ostringstream oss;
+    oss << "async_" << i << ".eig";
+    futures.push_back(boost::shared_ptr< boost::unique_future<void> >(new boost::unique_future<void>(saver.save(mat, oss.str()))));
+    EXPECT_TRUE(saver.bytesInFlight() <= sizeof(float) * mat.size());
+  }
+  saver.wait();
+  EXPECT_EQ(0, (int)saver.bytesInFlight());
+  for(size_t i = 0; i < futures.size(); ++i)
+    EXPECT_TRUE(futures[i]->is_ready());
+}
+
+TEST(EigenExtensions, AsyncSaveFailure)
+{
+  MatrixXf mat = MatrixXf::Random(100, 200);
+  SparseMatrix<double> sparse = MatrixXd::Random(300, 200).sparseView(0.5, 1);
+  eigen_extensions::AsyncSaver saver(1024 * 1024, 1);
+
+  // -- Failed saves reach the caller through get().
+  boost::unique_future<void> dense_future = saver.save(mat, "nonexistent_dir/async.eig");
+  boost::unique_future<void> gz_future = saver.save(mat, "nonexistent_dir/async.eig.gz");
+  boost::unique_future<void> sparse_future = saver.save(sparse, "nonexistent_dir/async_sparse.eig");
+  EXPECT_THROW(dense_future.get(), std::runtime_error);
+  EXPECT_THROW(gz_future.get(), std::runtime_error);
+  EXPECT_THROW(sparse_future.get(), std::runtime_error);
+
+  // -- The saver releases the budget and keeps working.
+  saver.wait();
+  EXPECT_EQ(0, (int)saver.bytesInFlight());
+  saver.save(mat, "async_after_failure.eig").get();
+  MatrixXf mat2;
+  eigen_extensions::load("async_after_failure.eig", &mat2);
+  EXPECT_TRUE(mat == mat2);
+}
+
 TEST(EigenExtensions, serialization_multi_ascii) {
   Vector3i vec = Vector3i::Random(3);
   MatrixXd mat = MatrixXd::Random(3, 5);
@@ -164,6 +1025,141 @@ TEST(EigenExtensions, SparseSerializationRowMajor)
   EXPECT_TRUE(mat.isApprox(mat2));
 }
 
+TEST(EigenExtensions, SparseSerializationBulk)
+{
+  // -- Random inserts leave the matrix uncompressed.
+  SparseMatrix<float> mat(1000, 300);
+  for(int i = 0; i < 5000; ++i)
+    mat.coeffRef(rand() % mat.rows(), rand() % mat.cols()) = rand() / (float)RAND_MAX;
+  EXPECT_FALSE(mat.isCompressed());
+  
+  eigen_extensions::save(mat, "sparse_bulk.eig");
+  SparseMatrix<float> mat2;
+  eigen_extensions::load("sparse_bulk.eig", &mat2);
+  EXPECT_TRUE(mat2.isCompressed());
+  EXPECT_EQ(mat.nonZeros(), mat2.nonZeros());
+  EXPECT_TRUE(mat.isApprox(mat2));
+
+  std::ifstream file("sparse_bulk.eig");
+  eigen_extensions::EigSparseHeader header;
+  eigen_extensions::deserializeHeader(file, &header);
+  file.close();
+  EXPECT_EQ(eigen_extensions::EIG_VERSION, header.version);
+  EXPECT_EQ(0, header.innerIndexOffset() % 64);
+  EXPECT_EQ(0, header.valueOffset() % 64);
+  EXPECT_EQ(header.size(), boost::filesystem::file_size("sparse_bulk.eig"));
+}
+
+//! Reads just the packed index stream of a serialized sparse matrix.
+bool readPacked(const string& data, SparseMatrix<float>* mat)
+{
+  std::istringstream iss(data);
+  eigen_extensions::EigSparseHeader header;
+  eigen_extensions::deserializeHeader(iss, &header);
+  mat->resize(header.inner, header.outer);
+  mat->resizeNonZeros(header.nnz);
+  return eigen_extensions::deserializePacked(iss, header, mat);
+}
+
+TEST(EigenExtensions, SparsePacked)
+{
+  // Bag-of-words-like: small integer counts, mostly index bytes.
+  SparseMatrix<float> mat(50000, 200);
+  for(int i = 0; i < 20000; ++i)
+    mat.coeffRef(rand() % mat.rows(), rand() % mat.cols()) += 1;
+  mat.makeCompressed();
+
+  eigen_extensions::save(mat, "sparse_raw.eig.gz");
+  eigen_extensions::SaveOptions opts;
+  opts.packed_indices = true;
+  opts.shuffle = true;
+  eigen_extensions::save(mat, "sparse_packed.eig", opts);
+  eigen_extensions::save(mat, "sparse_packed.eig.gz", opts);
+
+  cout << "Raw .eig.gz: " << boost::filesystem::file_size("sparse_raw.eig.gz") << " bytes." << endl;
+  cout << "Packed .eig: " << boost::filesystem::file_size("sparse_packed.eig") << " bytes." << endl;
+  cout << "Packed .eig.gz: " << boost::filesystem::file_size("sparse_packed.eig.gz") << " bytes." << endl;
+  EXPECT_LT(boost::filesystem::file_size("sparse_packed.eig.gz"), boost::filesystem::file_size("sparse_raw.eig.gz"));
+  
+  SparseMatrix<float> mat2;
+  eigen_extensions::load("sparse_raw.eig.gz", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+  eigen_extensions::load("sparse_packed.eig", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+  eigen_extensions::load("sparse_packed.eig.gz", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+
+  // -- Damaged index streams are rejected before anything is written out of bounds.
+  std::ifstream file("sparse_packed.eig", std::ios::binary);
+  string packed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  size_t begin = sizeof(eigen_extensions::EigSparseHeader);
+  uint64_t num;
+  memcpy(&num, &packed[begin], sizeof(num));
+  size_t last = begin + sizeof(num) + num - eigen_extensions::VARINT_OVERREAD - 1;
+  EXPECT_TRUE(readPacked(packed, &mat2));
+  EXPECT_FALSE(readPacked(packed.substr(0, begin + 1000), &mat2));
+  string corrupt = packed;
+  corrupt[begin + sizeof(num)] |= 0x80;
+  EXPECT_FALSE(readPacked(corrupt, &mat2));
+  corrupt = packed;
+  corrupt[last] |= 0x80;
+  EXPECT_FALSE(readPacked(corrupt, &mat2));
+  corrupt = packed;
+  corrupt[last + 1] = 1;
+  EXPECT_FALSE(readPacked(corrupt, &mat2));
+  corrupt = packed;
+  corrupt[begin + sizeof(num)] = 0x7f;
+  EXPECT_FALSE(readPacked(corrupt, &mat2));
+}
+
+TEST(EigenExtensions, MappedSparseMatrix)
+{
+  SparseMatrix<double, RowMajor> mat(300, 1000);
+  for(int i = 0; i < 3000; ++i)
+    mat.coeffRef(rand() % mat.rows(), rand() % mat.cols()) = rand() / (double)RAND_MAX;
+  eigen_extensions::save(mat, "sparse_mapped.eig");
+
+  eigen_extensions::MappedSparseMatrix<double, RowMajor> mapped("sparse_mapped.eig");
+  EXPECT_EQ(mat.rows(), mapped.matrix().rows());
+  EXPECT_EQ(mat.cols(), mapped.matrix().cols());
+  EXPECT_EQ(0, (size_t)mapped.matrix().valuePtr() % 64);
+  EXPECT_TRUE(mat.isApprox(mapped.matrix()));
+
+  VectorXd x = VectorXd::Random(mat.cols());
+  EXPECT_TRUE((mat * x).isApprox(mapped.matrix() * x));
+}
+
+TEST(EigenExtensions, SparseVersion1Compatibility)
+{
+  SparseMatrix<double> mat(5, 3);
+  mat.insert(0, 0) = 1;
+  mat.insert(1, 0) = 2;
+  mat.insert(4, 2) = 3;
+  mat.makeCompressed();
+
+  // -- The old per-element format.
+  std::ofstream file("sparse_v1.eig");
+  int header[5] = {sizeof(double), 0, (int)mat.outerSize(), (int)mat.innerSize(), (int)mat.nonZeros()};
+  file.write((char*)header, sizeof(header));
+  for(int i = 0; i < mat.outerSize(); ++i) {
+    int num = 0;
+    for(SparseMatrix<double>::InnerIterator it(mat, i); it; ++it)
+      ++num;
+    file.write((char*)&num, sizeof(num));
+    for(SparseMatrix<double>::InnerIterator it(mat, i); it; ++it) {
+      int idx = it.index();
+      double val = it.value();
+      file.write((char*)&idx, sizeof(idx));
+      file.write((char*)&val, sizeof(val));
+    }
+  }
+  file.close();
+
+  SparseMatrix<double> mat2;
+  eigen_extensions::load("sparse_v1.eig", &mat2);
+  EXPECT_TRUE(mat.isApprox(mat2));
+}
+
 // TEST(EigenExtensions, SparseVecSerialization)
 // {
 //   SparseVector<double> vec(5);